@@ -32,44 +32,151 @@ namespace clib {
     void cjs::error_handler(int, const std::vector<pda_trans> &, int &) {
     }
 
+    static std::string script_name(const std::string &filename, bool &entry) {
+        entry = !(!filename.empty() && (filename[0] == '<' || filename[0] == '('));
+        if (!entry)
+            return filename;
+        return "(" + filename + ":1:1) <entry>";
+    }
+
     int cjs::exec(const std::string &filename, const std::string &input, bool top) {
         if (input.empty())
             return 0;
-        auto p = std::make_unique<cjsparser>();
+        return exec(filename, cjs_source::from_string(input), top);
+    }
+
+    int cjs::exec(const std::string &filename, const cjs_source::ref &input, bool top) {
+        if (input->empty())
+            return 0;
         std::string error_string;
-        std::string code_name;
-        if (!filename.empty() && (filename[0] == '<' || filename[0] == '('))
-            code_name = filename;
-        else
-            code_name = "(" + filename + ":1:1) <entry>";
+        auto script = compile(filename, input, error_string);
+        if (!script) {
+            bool entry;
+            return rt.eval_error(js_value_new::ERROR_SyntaxError, error_string, script_name(filename, entry), top);
+        }
+        return rt.eval(script->info, filename, top);
+    }
+
+    cjs_script::ref cjs::compile(const std::string &filename, const std::string &input, std::string &error) {
+        return compile(filename, cjs_source::from_string(input), error);
+    }
+
+    cjs_script::ref cjs::compile(const std::string &filename, const cjs_source::ref &input, std::string &error) {
+        auto p = std::make_unique<cjsparser>();
+        p->set_threads(parse_threads);
+        bool entry;
+        auto code_name = script_name(filename, entry);
         cjs_code_result::ref code;
         try {
-            if (p->parse(input, error_string, this) == nullptr) {
-                std::stringstream ss;
-                ss << "throw new SyntaxError('" << jsv_string::convert(error_string) << "')";
-                return exec(code_name, ss.str());
-            }
+            if (p->parse(*input, error, this) == nullptr)
+                return nullptr;
 #if LOG_AST
-            cjsast::print(p->root(), 0, input, std::cout);
+            cjsast::print(p->root(), 0, *input, std::cout);
 #endif
             auto g = std::make_unique<cjsgen>();
-            g->gen_code(p->root(), &input, filename);
+            g->gen_code(p->root(), input, filename);
             p = nullptr;
 #if LOG_FILE
             std::ofstream ofs(LOG_FILENAME);
         if (ofs)
-            cjsast::print(p.root(), 0, input, ofs);
+            cjsast::print(p.root(), 0, *input, ofs);
 #endif
             code = std::move(g->get_code());
             assert(code);
             code->code->debugName = code_name;
+            if (entry) {
+                code->code->debugFile = filename;
+                code->code->debugLabel = "<entry>";
+            } else {
+                code->code->debugFile.clear();
+                code->code->debugLabel = code_name;
+            }
             g = nullptr;
         } catch (const clib::cexception &e) {
-            std::stringstream ss;
-            ss << "throw new SyntaxError('" << jsv_string::convert(e.message()) << "')";
-            return exec(code_name, ss.str());
+            error = e.message();
+            return nullptr;
+        }
+        auto script = std::make_shared<cjs_script>();
+        script->filename = filename;
+        script->info = rt.load(code);
+        if (!script->info) {
+            error = "Compile error";
+            return nullptr;
         }
-        return rt.eval(std::move(code), filename, top);
+        return script;
+    }
+
+    int cjs::run(const cjs_script::ref &script) {
+        return rt.eval(script->info, script->filename, true);
+    }
+
+    jsv_function::ref cjs::get_function(const std::string &name) const {
+        auto f = rt.get_global(name);
+        if (!f || f->get_type() != r_function)
+            return nullptr;
+        return JS_FUN(f);
+    }
+
+    int cjs::call(const cjs_script::ref &script, const jsv_function::ref &func,
+                  const std::vector<js_value::ref> &args, js_value::ref &ret) {
+        std::vector<js_value::weak_ref> _args(args.begin(), args.end());
+        return rt.call(script->info, func, _args, ret);
+    }
+
+    js_value::ref cjs::value(double d) {
+        return rt.new_number(d);
+    }
+
+    js_value::ref cjs::value(const std::string &s) {
+        return rt.new_string(s);
+    }
+
+    js_value::ref cjs::value(bool b) {
+        return rt.new_boolean(b);
+    }
+
+    js_value::ref cjs::undefined() {
+        return rt.new_undefined();
+    }
+
+    double cjs::to_number(const js_value::ref &v) {
+        return v->to_number(&rt);
+    }
+
+    std::string cjs::to_string(const js_value::ref &v) {
+        return v->to_string(&rt, 0);
+    }
+
+    void cjs::set_auto_loop(bool flag) {
+        rt.set_auto_loop(flag);
+    }
+
+    void cjs::set_register_vm(bool flag) {
+        rt.set_register_vm(flag);
+    }
+
+    void cjs::set_jit(bool enable, bool force) {
+        rt.set_jit(enable, force);
+    }
+
+    void cjs::set_max_depth(size_t depth) {
+        rt.set_max_depth(depth);
+    }
+
+    uint64_t cjs::get_steps() const {
+        return rt.get_steps();
+    }
+
+    bool cjs::run_one_task() {
+        return rt.run_one_task();
+    }
+
+    void cjs::run_until_idle() {
+        rt.run_until_idle();
+    }
+
+    void cjs::set_parse_threads(int n) {
+        parse_threads = n;
     }
 
     void cjs::init_lib() {
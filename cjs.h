@@ -12,6 +12,13 @@
 
 namespace clib {
 
+    class cjs_script {
+    public:
+        using ref = std::shared_ptr<cjs_script>;
+        std::string filename;
+        cjs_function_info::ref info;
+    };
+
     class cjs : public csemantic {
     public:
         cjs();
@@ -24,12 +31,41 @@ namespace clib {
         void error_handler(int, const std::vector<pda_trans>&, int&) override;
 
         int exec(const std::string &filename, const std::string& input, bool top = true);
+        int exec(const std::string &filename, const cjs_source::ref &input, bool top = true);
+
+        cjs_script::ref compile(const std::string &filename, const std::string &input, std::string &error);
+        cjs_script::ref compile(const std::string &filename, const cjs_source::ref &input, std::string &error);
+        int run(const cjs_script::ref &script);
+        jsv_function::ref get_function(const std::string &name) const;
+        // returns 0, or 9 if an exception was thrown (ret holds the error)
+        // ret is owned by the runtime and valid until the next call into it
+        // with auto_loop on (the default) the event loop is drained before returning,
+        // so timers set by func have fired; with it off only microtasks are run
+        int call(const cjs_script::ref &script, const jsv_function::ref &func,
+                 const std::vector<js_value::ref> &args, js_value::ref &ret);
+
+        js_value::ref value(double);
+        js_value::ref value(const std::string &);
+        js_value::ref value(bool);
+        js_value::ref undefined();
+        double to_number(const js_value::ref &);
+        std::string to_string(const js_value::ref &);
+
+        void set_auto_loop(bool); // 关闭后exec/call只执行微任务，定时器由run_one_task/run_until_idle驱动
+        void set_register_vm(bool); // 函数体改用寄存器字节码执行
+        void set_jit(bool enable, bool force = false); // force为真时首次执行即编译
+        void set_max_depth(size_t depth); // 调用栈深度上限，超出时抛出RangeError
+        uint64_t get_steps() const; // 已执行的指令数
+        bool run_one_task();
+        void run_until_idle();
+        void set_parse_threads(int); // 大文件按顶层语句分段并行解析
 
     private:
         void init_lib();
 
     private:
         cjsruntime rt;
+        int parse_threads{1};
     };
 }
 
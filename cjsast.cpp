@@ -171,7 +171,7 @@ namespace clib {
     }
 
     template<class T>
-    static void ast_recursion(ast_node *node, int level, const std::string &text, std::ostream &os, T f) {
+    static void ast_recursion(ast_node *node, int level, const cjs_source &text, std::ostream &os, T f) {
         if (node == nullptr)
             return;
         auto i = node;
@@ -187,7 +187,7 @@ namespace clib {
         }
     }
 
-    void cjsast::print(ast_node *node, int level, const std::string &text, std::ostream &os) {
+    void cjsast::print(ast_node *node, int level, const cjs_source &text, std::ostream &os) {
         if (node == nullptr)
             return;
         auto rec = [&](auto n, auto l, const auto &t, auto &os) { cjsast::print(n, l, t, os); };
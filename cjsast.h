@@ -9,6 +9,7 @@
 #include <cstdint>
 #include "cjstypes.h"
 #include "cjsmem.h"
+#include "cjssource.h"
 
 namespace clib {
 
@@ -70,7 +71,7 @@ namespace clib {
 
         void to(ast_to_t type);
 
-        static void print(ast_node *node, int level, const std::string &text, std::ostream &os);
+        static void print(ast_node *node, int level, const cjs_source &text, std::ostream &os);
         static std::string to_string(ast_node *node);
         static bool ast_equal(ast_t type, lexer_t lex);
 
@@ -16,6 +16,8 @@
 #define PRINT_CODE 1
 #define DUMP_CODE 1
 #define PRINT_AST 0
+#define OPTIMIZE_CODE 1
+#define PEEPHOLE_CODE 1
 
 #define AST_IS_KEYWORD(node) ((node)->flag == a_keyword)
 #define AST_IS_KEYWORD_K(node, k) ((node)->data._keyword == (k))
@@ -34,6 +36,26 @@ namespace clib {
         tmp.emplace_back();
         ast.emplace_back();
         codes.push_back(std::make_shared<sym_code_t>());
+        arenas.push_back(std::make_unique<sym_arena>());
+    }
+
+    sym_arena::~sym_arena() {
+        for (auto i = nodes.rbegin(); i != nodes.rend(); i++)
+            (*i)->~sym_t();
+    }
+
+    char *sym_arena::alloc(size_t size, size_t align) {
+        used = (used + align - 1) & ~(align - 1);
+        if (used + size > capacity) {
+            // 小函数占用少，块大小从SYM_ARENA_MIN_BLOCK倍增到SYM_ARENA_BLOCK
+            capacity = std::max(size, next);
+            blocks.emplace_back(new char[capacity]);
+            used = 0;
+            next = std::min(next * 2, (size_t) SYM_ARENA_BLOCK);
+        }
+        auto p = blocks.back().get() + used;
+        used += size;
+        return p;
     }
 
     void copy_info(sym_t::ref dst, ast_node *src) {
@@ -126,7 +148,7 @@ namespace clib {
     std::string cjs_consts::get_desc(int n) const {
         auto f = functions.find(n);
         if (f != functions.end()) {
-            auto func = f->second.lock();
+            const auto &func = f->second;
             return func->name ? func->name->data._identifier : LAMBDA_ID;
         }
         for (const auto &x : strings) {
@@ -163,7 +185,7 @@ namespace clib {
         return globals_data.at(n);
     }
 
-    void cjs_consts::dump(const std::string *text) const {
+    void cjs_consts::dump(const cjs_source *text) const {
         auto i = 0;
         for (const auto &x : names_data) {
             fprintf(stdout, "C [#%03d] [NAME  ] %s\n", i++, x);
@@ -186,7 +208,7 @@ namespace clib {
                     fprintf(stdout, "C [#%03d] [NUMBER] %s\n", i, jsv_number::number_to_string(*(double *) x).c_str());
                     break;
                 case r_function: {
-                    auto f = functions.at(i).lock();
+                    const auto &f = functions.at(i);
                     fprintf(stdout, "C [#%03d] [FUNC  ] %s | %s\n", i, f->debugName.c_str(),
                             text->substr(f->start, f->end - f->start).c_str());
                 }
@@ -252,23 +274,28 @@ namespace clib {
         return derefs_data;
     }
 
-    bool cjsgen::gen_code(ast_node *node, const std::string *str, const std::string &name) {
+    bool cjsgen::gen_code(ast_node *node, const cjs_source::ref &src, const std::string &name) {
         filename = name;
-        text = str;
+        text = src;
         gen_rec(node, 0);
         if (tmp.front().empty())
             return false;
+        ast.clear();
         tmp.front().front()->set_parent(nullptr);
-        tmp.front().front()->gen_rvalue(*this);
 #if PRINT_AST && DEBUG_MODE
         print(tmp.front().front(), 0, std::cout);
 #endif
+        tmp.front().front()->gen_rvalue(*this);
+        tmp.clear();
         decltype(codes) _codes(1 + funcs.size());
         _codes[0] = codes.front();
         std::copy(funcs.begin(), funcs.end(), _codes.begin() + 1);
         for (auto &c : _codes) {
+#if OPTIMIZE_CODE
+            optimize(c->codes);
+#endif
             c->consts.save();
-            c->text = text->substr(c->start, c->end - c->start);
+            c->source = text;
         }
 #if DUMP_CODE && DEBUG_MODE
         dump();
@@ -405,6 +432,12 @@ namespace clib {
 
     bool cjsgen::gen_before(const std::vector<ast_node *> &nodes, int level, ast_node *node) {
         switch (node->data._coll) {
+            case c_functionDeclaration:
+            case c_anonymousFunctionDecl:
+            case c_arrowFunction:
+                // 函数体的符号节点单独分配，gen_after结束时交给函数
+                arenas.push_back(std::make_unique<sym_arena>());
+                break;
             case c_prefixExpression: {
                 if (AST_IS_COLL_K(nodes.front(), c_prefixExpressionList)) {
                     gen_rec(nodes[1], level); // gen exp first
@@ -417,7 +450,7 @@ namespace clib {
             }
                 break;
             case c_tryStatement: {
-                auto stmt = std::make_shared<sym_stmt_try_t>();
+                auto stmt = make<sym_stmt_try_t>();
                 tmp.back().push_back(stmt);
             }
             default:
@@ -431,7 +464,7 @@ namespace clib {
         auto &tmps = tmp.back();
         switch (node->data._coll) {
             case c_block: {
-                auto block = std::make_shared<sym_block_t>();
+                auto block = make<sym_block_t>();
                 copy_info(block, asts.front());
                 block->end = asts.back()->end;
                 for (const auto &s : tmps) {
@@ -443,11 +476,11 @@ namespace clib {
             }
                 break;
             case c_variableDeclarationList: {
-                auto stmt = std::make_shared<sym_stmt_var_t>();
+                auto stmt = make<sym_stmt_var_t>();
                 copy_info(stmt, tmps.front());
                 for (const auto &s : tmps) {
                     assert(s->get_type() == s_id);
-                    stmt->vars.push_back(std::dynamic_pointer_cast<sym_id_t>(s));
+                    stmt->vars.push_back(dynamic_cast<sym_id_t *>(s));
                     stmt->end = s->end;
                 }
                 asts.clear();
@@ -456,16 +489,16 @@ namespace clib {
             }
                 break;
             case c_variableDeclaration: {
-                auto r = std::make_shared<sym_var_t>(asts.front());
+                auto r = make<sym_var_t>(asts.front());
                 copy_info(r, asts.front());
-                auto id = std::make_shared<sym_id_t>();
+                auto id = make<sym_id_t>();
                 id->ids.push_back(r);
                 copy_info(id, r);
                 if (!tmps.empty()) {
                     id->init = to_exp(tmps.front());
                     copy_info(id->init, tmps.front());
                     id->end = id->init->end;
-                    id->parse();
+                    id->parse(*arenas.back());
                 }
                 asts.clear();
                 tmps.clear();
@@ -473,7 +506,7 @@ namespace clib {
             }
                 break;
             case c_emptyStatement: {
-                auto empty = std::make_shared<sym_stmt_t>();
+                auto empty = make<sym_stmt_t>();
                 copy_info(empty, asts.front());
                 asts.clear();
                 tmps.push_back(empty);
@@ -481,17 +514,17 @@ namespace clib {
                 break;
             case c_expressionStatement: {
                 if (tmps.front()->get_type() == s_expression_seq) {
-                    auto stmt = std::make_shared<sym_stmt_exp_t>();
+                    auto stmt = make<sym_stmt_exp_t>();
                     copy_info(stmt, tmps.front());
-                    stmt->seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.front());
+                    stmt->seq = dynamic_cast<sym_exp_seq_t *>(tmps.front());
                     asts.clear();
                     tmps.clear();
                     tmps.push_back(stmt);
                 } else if (tmps.front()->get_base_type() == s_expression) {
-                    auto seq = std::make_shared<sym_exp_seq_t>();
+                    auto seq = make<sym_exp_seq_t>();
                     copy_info(seq, tmps.front());
                     seq->exps.push_back(to_exp(tmps.front()));
-                    auto stmt = std::make_shared<sym_stmt_exp_t>();
+                    auto stmt = make<sym_stmt_exp_t>();
                     copy_info(stmt, tmps.front());
                     stmt->seq = seq;
                     asts.clear();
@@ -501,14 +534,14 @@ namespace clib {
             }
                 break;
             case c_ifStatement: {
-                auto _if = std::make_shared<sym_stmt_if_t>();
+                auto _if = make<sym_stmt_if_t>();
                 copy_info(_if, asts.front());
                 _if->end = tmps.back()->end;
                 assert(tmps.front()->get_base_type() == s_expression);
                 if (tmps.front()->get_type() == s_expression_seq) {
-                    _if->seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.front());
+                    _if->seq = dynamic_cast<sym_exp_seq_t *>(tmps.front());
                 } else {
-                    _if->seq = std::make_shared<sym_exp_seq_t>();
+                    _if->seq = make<sym_exp_seq_t>();
                     copy_info(_if->seq, tmps.front());
                     _if->seq->exps.push_back(to_exp(tmps.front()));
                 }
@@ -524,15 +557,15 @@ namespace clib {
             }
                 break;
             case c_doStatement: {
-                auto _while = std::make_shared<sym_stmt_while_t>();
+                auto _while = make<sym_stmt_while_t>();
                 _while->do_while = true;
                 copy_info(_while, asts.front());
                 _while->end = tmps.back()->end;
                 assert(tmps.back()->get_base_type() == s_expression);
                 if (tmps.back()->get_type() == s_expression_seq) {
-                    _while->seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.back());
+                    _while->seq = dynamic_cast<sym_exp_seq_t *>(tmps.back());
                 } else {
-                    _while->seq = std::make_shared<sym_exp_seq_t>();
+                    _while->seq = make<sym_exp_seq_t>();
                     copy_info(_while->seq, tmps.back());
                     _while->seq->exps.push_back(to_exp(tmps.back()));
                 }
@@ -543,14 +576,14 @@ namespace clib {
             }
                 break;
             case c_whileStatement: {
-                auto _while = std::make_shared<sym_stmt_while_t>();
+                auto _while = make<sym_stmt_while_t>();
                 copy_info(_while, asts.front());
                 _while->end = tmps.back()->end;
                 assert(tmps.front()->get_base_type() == s_expression);
                 if (tmps.front()->get_type() == s_expression_seq) {
-                    _while->seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.front());
+                    _while->seq = dynamic_cast<sym_exp_seq_t *>(tmps.front());
                 } else {
-                    _while->seq = std::make_shared<sym_exp_seq_t>();
+                    _while->seq = make<sym_exp_seq_t>();
                     copy_info(_while->seq, tmps.front());
                     _while->seq->exps.push_back(to_exp(tmps.front()));
                 }
@@ -561,7 +594,7 @@ namespace clib {
             }
                 break;
             case c_forStatement: {
-                auto _for = std::make_shared<sym_stmt_for_t>();
+                auto _for = make<sym_stmt_for_t>();
                 copy_info(_for, asts.front());
                 _for->end = tmps.back()->end;
                 auto semi1 = AST_IS_KEYWORD_K(asts[1], K_VAR) ? asts[2] : asts[1];
@@ -570,7 +603,7 @@ namespace clib {
                     if (t->start < semi1->start) {
                         if (AST_IS_KEYWORD_K(asts[1], K_VAR)) {
                             assert(t->get_type() == s_statement_var);
-                            _for->vars = std::dynamic_pointer_cast<sym_stmt_var_t>(t);
+                            _for->vars = dynamic_cast<sym_stmt_var_t *>(t);
                             _for->vars->start = asts[1]->start;
                         } else {
                             _for->exp = to_exp(t);
@@ -589,7 +622,7 @@ namespace clib {
             }
                 break;
             case c_forInStatement: {
-                auto _for_in = std::make_shared<sym_stmt_for_in_t>();
+                auto _for_in = make<sym_stmt_for_in_t>();
                 copy_info(_for_in, asts.front());
                 _for_in->end = tmps.back()->end;
                 assert(tmps.size() >= 3);
@@ -597,7 +630,7 @@ namespace clib {
                     _for_in->exp = to_exp(tmps[0]);
                 } else {
                     assert(tmps[0]->get_type() == s_statement_var);
-                    auto var = std::dynamic_pointer_cast<sym_stmt_var_t>(tmps[0]);
+                    auto var = dynamic_cast<sym_stmt_var_t *>(tmps[0]);
                     assert(var->vars.size() == 1);
                     _for_in->vars = var->vars.front();
                     _for_in->vars->start = asts[1]->start;
@@ -612,7 +645,7 @@ namespace clib {
                 break;
             case c_continueStatement:
             case c_breakStatement: {
-                auto _ctrl = std::make_shared<sym_stmt_control_t>();
+                auto _ctrl = make<sym_stmt_control_t>();
                 _ctrl->keyword = asts[0]->data._keyword;
                 copy_info(_ctrl, asts.front());
                 if (!tmps.empty()) {
@@ -624,14 +657,14 @@ namespace clib {
             }
                 break;
             case c_returnStatement: {
-                auto stmt = std::make_shared<sym_stmt_return_t>();
+                auto stmt = make<sym_stmt_return_t>();
                 copy_info(stmt, asts.front());
                 if (!tmps.empty()) {
                     sym_exp_seq_t::ref seq;
                     if (tmps.back()->get_type() == s_expression_seq) {
-                        seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.back());
+                        seq = dynamic_cast<sym_exp_seq_t *>(tmps.back());
                     } else {
-                        seq = std::make_shared<sym_exp_seq_t>();
+                        seq = make<sym_exp_seq_t>();
                         copy_info(seq, tmps.front());
                         seq->exps.push_back(to_exp(tmps.front()));
                     }
@@ -644,7 +677,7 @@ namespace clib {
             }
                 break;
             case c_switchStatement: {
-                auto stmt = std::make_shared<sym_stmt_switch_t>();
+                auto stmt = make<sym_stmt_switch_t>();
                 copy_info(stmt, asts.front());
                 stmt->end = asts.back()->end;
                 stmt->exp = to_exp(tmps.front());
@@ -652,16 +685,16 @@ namespace clib {
                                std::back_inserter(stmt->cases),
                                [](const auto &s) {
                                    assert(s->get_type() == s_case);
-                                   return std::dynamic_pointer_cast<sym_case_t>(s);
+                                   return dynamic_cast<sym_case_t *>(s);
                                });
                 std::unordered_map<std::string, ast_node_index *> cond;
                 for (const auto &s : stmt->cases) {
-                    auto str = s->exp ? get_code_text(s->exp.get()) : "default";
+                    auto str = s->exp ? get_code_text(s->exp) : "default";
                     auto f = cond.find(str);
                     if (f != cond.end()) {
                         error(f->second, "conflict case: " + str);
                     }
-                    cond.insert({str, s.get()});
+                    cond.insert({str, s});
                 }
                 asts.clear();
                 tmps.clear();
@@ -669,7 +702,7 @@ namespace clib {
             }
                 break;
             case c_caseClause: {
-                auto exp = std::make_shared<sym_case_t>();
+                auto exp = make<sym_case_t>();
                 copy_info(exp, asts.front());
                 exp->end = tmps.size() > 1 ? tmps.back()->end : asts.back()->end;
                 exp->exp = to_exp(tmps.front());
@@ -677,7 +710,7 @@ namespace clib {
                                std::back_inserter(exp->stmts),
                                [](const auto &s) {
                                    assert(s->get_base_type() == s_statement);
-                                   return std::dynamic_pointer_cast<sym_stmt_t>(s);
+                                   return dynamic_cast<sym_stmt_t *>(s);
                                });
                 asts.clear();
                 tmps.clear();
@@ -685,14 +718,14 @@ namespace clib {
             }
                 break;
             case c_defaultClause: {
-                auto exp = std::make_shared<sym_case_t>();
+                auto exp = make<sym_case_t>();
                 copy_info(exp, asts.front());
                 exp->end = !tmps.empty() ? tmps.back()->end : asts.back()->end;
                 std::transform(tmps.begin(), tmps.end(),
                                std::back_inserter(exp->stmts),
                                [](const auto &s) {
                                    assert(s->get_base_type() == s_statement);
-                                   return std::dynamic_pointer_cast<sym_stmt_t>(s);
+                                   return dynamic_cast<sym_stmt_t *>(s);
                                });
                 asts.clear();
                 tmps.clear();
@@ -700,14 +733,14 @@ namespace clib {
             }
                 break;
             case c_throwStatement: {
-                auto stmt = std::make_shared<sym_stmt_throw_t>();
+                auto stmt = make<sym_stmt_throw_t>();
                 copy_info(stmt, asts.front());
                 if (!tmps.empty()) {
                     sym_exp_seq_t::ref seq;
                     if (tmps.back()->get_type() == s_expression_seq) {
-                        seq = std::dynamic_pointer_cast<sym_exp_seq_t>(tmps.back());
+                        seq = dynamic_cast<sym_exp_seq_t *>(tmps.back());
                     } else {
-                        seq = std::make_shared<sym_exp_seq_t>();
+                        seq = make<sym_exp_seq_t>();
                         copy_info(seq, tmps.front());
                         seq->exps.push_back(to_exp(tmps.front()));
                     }
@@ -721,7 +754,7 @@ namespace clib {
                 break;
             case c_tryStatement: {
                 assert(tmps.front()->get_type() == s_statement_try);
-                auto stmt = std::dynamic_pointer_cast<sym_stmt_try_t>(tmps.front());
+                auto stmt = dynamic_cast<sym_stmt_try_t *>(tmps.front());
                 copy_info(stmt, asts.front());
                 stmt->try_body = to_stmt(tmps.back());
                 if (stmt->finally_body)
@@ -734,7 +767,7 @@ namespace clib {
                 break;
             case c_catchProduction: {
                 assert((*(tmp.rbegin() + 1)).front()->get_type() == s_statement_try);
-                auto stmt = std::dynamic_pointer_cast<sym_stmt_try_t>((*(tmp.rbegin() + 1)).front());
+                auto stmt = dynamic_cast<sym_stmt_try_t *>((*(tmp.rbegin() + 1)).front());
                 if (!asts.empty()) {
                     stmt->var = primary_node(asts.front());
                     copy_info(stmt->var, asts.front());
@@ -746,14 +779,14 @@ namespace clib {
                 break;
             case c_finallyProduction: {
                 assert((*(tmp.rbegin() + 1)).front()->get_type() == s_statement_try);
-                auto stmt = std::dynamic_pointer_cast<sym_stmt_try_t>((*(tmp.rbegin() + 1)).front());
+                auto stmt = dynamic_cast<sym_stmt_try_t *>((*(tmp.rbegin() + 1)).front());
                 stmt->finally_body = to_stmt(tmps.front());
                 tmps.clear();
             }
                 break;
             case c_functionStatement: {
-                auto stmt = std::make_shared<sym_stmt_exp_t>();
-                auto seq = std::make_shared<sym_exp_seq_t>();
+                auto stmt = make<sym_stmt_exp_t>();
+                auto seq = make<sym_exp_seq_t>();
                 stmt->seq = seq;
                 seq->exps.push_back(to_exp(tmps.front()));
                 copy_info(seq, tmps.front());
@@ -763,7 +796,7 @@ namespace clib {
             }
                 break;
             case c_functionDeclaration: {
-                auto code = std::make_shared<sym_code_t>();
+                auto code = new_code();
                 copy_info(code, asts[0]);
                 code->name = asts[1];
                 code->end = asts.back()->end;
@@ -796,7 +829,7 @@ namespace clib {
             }
                 break;
             case c_sourceElements: {
-                auto block = std::make_shared<sym_block_t>();
+                auto block = make<sym_block_t>();
                 if (!tmps.empty()) {
                     copy_info(block, tmps.front());
                 }
@@ -810,7 +843,7 @@ namespace clib {
             }
                 break;
             case c_arrayLiteral: {
-                auto array = std::make_shared<sym_array_t>();
+                auto array = make<sym_array_t>();
                 copy_info(array, asts.front());
                 array->end = asts.back()->end;
                 if (AST_IS_COLL_K(nodes[1], c_elementList)) {
@@ -840,13 +873,13 @@ namespace clib {
             }
                 break;
             case c_objectLiteral: {
-                auto obj = std::make_shared<sym_object_t>();
+                auto obj = make<sym_object_t>();
                 copy_info(obj, asts.front());
                 obj->end = asts.back()->end;
                 for (const auto &s : tmps) {
                     obj->is_pair.push_back(s->get_type() == s_object_pair);
                     if (s->get_type() == s_object_pair)
-                        obj->pairs.push_back(std::dynamic_pointer_cast<sym_object_pair_t>(s));
+                        obj->pairs.push_back(dynamic_cast<sym_object_pair_t *>(s));
                     else
                         obj->rests.push_back(to_exp(s));
                 }
@@ -857,7 +890,7 @@ namespace clib {
                 break;
             case c_expressionSequence: {
                 if (tmps.size() > 1) {
-                    auto seq = std::make_shared<sym_exp_seq_t>();
+                    auto seq = make<sym_exp_seq_t>();
                     if (!tmps.empty()) {
                         copy_info(seq, tmps.front());
                     }
@@ -872,20 +905,13 @@ namespace clib {
             }
                 break;
             case c_propertyExpressionAssignment: {
-                auto p = std::make_shared<sym_object_pair_t>();
+                auto p = make<sym_object_pair_t>();
                 if (tmps.size() == 2) {
                     copy_info(p, tmps.front());
                     p->end = tmps.back()->end;
                     p->key = to_exp(tmps.front());
                     p->value = to_exp(tmps.back());
                 } else {
-                    if (tmps.front()->get_type() == s_var_id) {
-                        auto id = std::dynamic_pointer_cast<sym_var_id_t>(tmps.front());
-                        id->node->flag = a_string;
-                        auto new_id = std::make_shared<sym_var_t>(id->node);
-                        copy_info(new_id, tmps.front());
-                        tmps.front() = new_id;
-                    }
                     copy_info(p, asts.front());
                     p->end = tmps.back()->end;
                     if (AST_IS_ID(asts.front())) {
@@ -908,7 +934,7 @@ namespace clib {
             }
                 break;
             case c_anonymousFunctionDecl: {
-                auto code = std::make_shared<sym_code_t>();
+                auto code = new_code();
                 copy_info(code, asts[0]);
                 code->end = asts.back()->end;
                 asts.pop_back();
@@ -940,7 +966,7 @@ namespace clib {
             }
                 break;
             case c_arrowFunction: {
-                auto code = std::make_shared<sym_code_t>();
+                auto code = new_code();
                 code->arrow = true;
                 copy_info(code, asts[0]);
                 code->end = tmps.back()->end;
@@ -985,7 +1011,7 @@ namespace clib {
             case c_memberIndexExpression: {
                 auto exp = to_exp((tmp.rbegin() + 2)->front());
                 if (exp->get_type() != s_member_index) {
-                    auto t = std::make_shared<sym_member_index_t>(exp);
+                    auto t = make<sym_member_index_t>(exp);
                     copy_info(t, exp);
                     tmps.front()->start = asts.front()->start;
                     tmps.front()->line = asts.front()->line;
@@ -995,7 +1021,7 @@ namespace clib {
                     t->end = tmps.front()->end;
                     (tmp.rbegin() + 2)->back() = t;
                 } else {
-                    auto t = std::dynamic_pointer_cast<sym_member_index_t>(exp);
+                    auto t = dynamic_cast<sym_member_index_t *>(exp);
                     tmps.front()->start = asts.front()->start;
                     tmps.front()->line = asts.front()->line;
                     tmps.front()->column = asts.front()->column;
@@ -1010,13 +1036,13 @@ namespace clib {
             case c_memberDotExpression: {
                 auto exp = to_exp((tmp.rbegin() + 2)->front());
                 if (exp->get_type() != s_member_dot) {
-                    auto t = std::make_shared<sym_member_dot_t>(exp);
+                    auto t = make<sym_member_dot_t>(exp);
                     copy_info(t, exp);
                     t->dots.push_back(asts.front());
                     t->end = asts.front()->end;
                     (tmp.rbegin() + 2)->back() = t;
                 } else {
-                    auto t = std::dynamic_pointer_cast<sym_member_dot_t>(exp);
+                    auto t = dynamic_cast<sym_member_dot_t *>(exp);
                     t->dots.push_back(asts.front());
                     t->end = asts.front()->end;
                 }
@@ -1026,9 +1052,9 @@ namespace clib {
             case c_argumentsExpression: {
                 auto exp = to_exp((tmp.rbegin() + 2)->front());
                 if (exp->get_type() == s_member_dot) { // a.b(...)
-                    auto old = std::dynamic_pointer_cast<sym_member_dot_t>(exp);
+                    auto old = dynamic_cast<sym_member_dot_t *>(exp);
                     if (old->dots.size() > 1) { // a.b.c()
-                        auto t = std::make_shared<sym_call_method_t>();
+                        auto t = make<sym_call_method_t>();
                         copy_info(t, exp);
                         t->method = old->dots.back();
                         old->dots.pop_back();
@@ -1050,7 +1076,7 @@ namespace clib {
                         }
                         (tmp.rbegin() + 2)->back() = t;
                     } else { // a.b()
-                        auto t = std::make_shared<sym_call_method_t>();
+                        auto t = make<sym_call_method_t>();
                         copy_info(t, exp);
                         t->method = old->dots.back();
                         t->obj = old->exp;
@@ -1070,8 +1096,35 @@ namespace clib {
                         }
                         (tmp.rbegin() + 2)->back() = t;
                     }
+                } else if (exp->get_type() == s_member_index) { // a[b](...)
+                    auto old = dynamic_cast<sym_member_index_t *>(exp);
+                    auto t = make<sym_call_method_t>();
+                    copy_info(t, exp);
+                    t->index = old->indexes.back();
+                    old->indexes.pop_back();
+                    if (old->indexes.empty()) {
+                        t->obj = old->exp;
+                    } else {
+                        old->end = old->indexes.back()->end;
+                        t->obj = old;
+                    }
+                    t->end = asts.back()->end;
+                    if (asts.empty())
+                        for (const auto &s : tmps)
+                            t->args.push_back(to_exp(s));
+                    else {
+                        size_t i = 0;
+                        for (const auto &s : tmps) {
+                            if (i < asts.size() && s->start > asts[i]->start) {
+                                t->rests.push_back(t->args.size());
+                                i++;
+                            }
+                            t->args.push_back(to_exp(s));
+                        }
+                    }
+                    (tmp.rbegin() + 2)->back() = t;
                 } else { // a(...)
-                    auto t = std::make_shared<sym_call_function_t>();
+                    auto t = make<sym_call_function_t>();
                     copy_info(t, exp);
                     t->obj = exp;
                     t->end = asts.back()->end;
@@ -1097,7 +1150,7 @@ namespace clib {
             case c_postIncrementExpression:
             case c_postDecreaseExpression: {
                 auto exp = to_exp((tmp.rbegin() + 2)->front());
-                auto t = std::make_shared<sym_sinop_t>(exp, asts.front());
+                auto t = make<sym_sinop_t>(exp, asts.front());
                 copy_info(t, exp);
                 t->end = asts.front()->end;
                 (tmp.rbegin() + 2)->back() = t;
@@ -1105,9 +1158,9 @@ namespace clib {
             }
                 break;
             case c_newExpression: {
-                auto exp = std::make_shared<sym_new_t>();
+                auto exp = make<sym_new_t>();
                 if (tmps.size() == 1 && tmps.front()->get_type() == s_call_function) {
-                    auto call = std::dynamic_pointer_cast<sym_call_function_t>(tmps.front());
+                    auto call = dynamic_cast<sym_call_function_t *>(tmps.front());
                     copy_info(exp, asts.front());
                     exp->end = call->end;
                     exp->obj = call->obj;
@@ -1123,7 +1176,7 @@ namespace clib {
                                        std::back_inserter(exp->args),
                                        [](const auto &s) {
                                            assert(s->get_base_type() == s_expression);
-                                           return std::dynamic_pointer_cast<sym_exp_t>(s);
+                                           return dynamic_cast<sym_exp_t *>(s);
                                        });
                     } else {
                         size_t i = 1;
@@ -1153,7 +1206,7 @@ namespace clib {
                 auto &op = asts[0];
                 auto &_exp = (tmp.rbegin() + 2)->front();
                 auto exp = to_exp(_exp);
-                auto unop = std::make_shared<sym_unop_t>(exp, op);
+                auto unop = make<sym_unop_t>(exp, op);
                 copy_info(unop, exp);
                 unop->start = op->start;
                 unop->line = op->line;
@@ -1184,7 +1237,7 @@ namespace clib {
                         if (node->data._coll == c_ternaryExpression &&
                             AST_IS_OP_K(a, T_QUERY)) { // triop
                             auto exp3 = to_exp(tmps[tmp_i++]);
-                            auto t = std::make_shared<sym_triop_t>(exp1, exp2, exp3, a, asts[i + 1]);
+                            auto t = make<sym_triop_t>(exp1, exp2, exp3, a, asts[i + 1]);
                             copy_info(t, exp1);
                             t->end = exp3->end;
                             exp1 = t;
@@ -1192,7 +1245,7 @@ namespace clib {
                                 exp2 = to_exp(tmps[tmp_i++]);
                             i++;
                         } else { // binop
-                            auto t = std::make_shared<sym_binop_t>(exp1, exp2, a);
+                            auto t = make<sym_binop_t>(exp1, exp2, a);
                             copy_info(t, exp1);
                             t->end = exp2->end;
                             exp1 = t;
@@ -1217,7 +1270,7 @@ namespace clib {
                 auto exp2 = to_exp(tmps[tmp_i++]);
                 for (auto &a : asts) {
                     if (AST_IS_OP(a)) {
-                        auto t = std::make_shared<sym_binop_t>(exp2, exp1, a);
+                        auto t = make<sym_binop_t>(exp2, exp1, a);
                         copy_info(t, exp2);
                         t->end = exp1->end;
                         exp1 = t;
@@ -1256,6 +1309,16 @@ namespace clib {
             default:
                 break;
         }
+        switch (node->data._coll) {
+            case c_functionDeclaration:
+            case c_anonymousFunctionDecl:
+            case c_arrowFunction:
+                decls.back()->syms = std::move(arenas.back());
+                arenas.pop_back();
+                break;
+            default:
+                break;
+        }
     }
 
     void cjsgen::error(ast_node *node, const std::string &str, bool info) const {
@@ -1278,13 +1341,18 @@ namespace clib {
     sym_exp_t::ref cjsgen::to_exp(const sym_t::ref &s) {
         if (s->get_base_type() != s_expression)
             error(s, "need expression: " + s->to_string());
-        return std::dynamic_pointer_cast<sym_exp_t>(s);
+        return dynamic_cast<sym_exp_t *>(s);
     }
 
     sym_stmt_t::ref cjsgen::to_stmt(const sym_t::ref &s) {
         if (s->get_base_type() != s_statement)
             error(s, "need statement: " + s->to_string());
-        return std::dynamic_pointer_cast<sym_stmt_t>(s);
+        return dynamic_cast<sym_stmt_t *>(s);
+    }
+
+    sym_code_t *cjsgen::new_code() {
+        decls.push_back(std::make_shared<sym_code_t>());
+        return decls.back().get();
     }
 
     sym_t::ref cjsgen::find_symbol(ast_node *node) {
@@ -1295,17 +1363,17 @@ namespace clib {
         switch (node->flag) {
             case a_literal: {
                 auto sym = find_symbol(node);
-                return std::make_shared<sym_var_id_t>(node, sym);
+                return make<sym_var_id_t>(node, sym);
             }
             case a_string:
             case a_regex:
             case a_number:
-                return std::make_shared<sym_var_t>(node);
+                return make<sym_var_t>(node);
             case a_keyword: {
                 if (AST_IS_KEYWORD_K(node, K_TRUE) || AST_IS_KEYWORD_K(node, K_FALSE) ||
                     AST_IS_KEYWORD_K(node, K_NULL) || AST_IS_KEYWORD_K(node, K_UNDEFINED) ||
                     AST_IS_KEYWORD_K(node, K_THIS))
-                    return std::make_shared<sym_var_t>(node);
+                    return make<sym_var_t>(node);
                 else
                     error(node, "invalid var keyword type: ", true);
             }
@@ -1313,7 +1381,7 @@ namespace clib {
             default:
                 break;
         }
-        return std::make_shared<sym_var_t>(node);
+        return make<sym_var_t>(node);
     }
 
     void cjsgen::print(const sym_t::ref &node, int level, std::ostream &os) {
@@ -1331,7 +1399,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_id_t>(node);
+                    auto n = dynamic_cast<sym_id_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "id" << std::endl;
                     for (const auto &s : n->ids) {
@@ -1353,7 +1421,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_var_t>(node);
+                    auto n = dynamic_cast<sym_var_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << cjsast::to_string(n->node) << std::endl;
                 }
@@ -1365,7 +1433,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_var_t>(node);
+                    auto n = dynamic_cast<sym_var_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     switch (n->clazz) {
                         case sym_var_t::local:
@@ -1395,7 +1463,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_unop_t>(node);
+                    auto n = dynamic_cast<sym_unop_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "op: " << lexer_string(n->op->data._op)
                        << " " << "[" << n->op->line << ":"
@@ -1414,7 +1482,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_sinop_t>(node);
+                    auto n = dynamic_cast<sym_sinop_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "exp" << std::endl;
                     print(n->exp, level + 2, os);
@@ -1433,7 +1501,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_binop_t>(node);
+                    auto n = dynamic_cast<sym_binop_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "exp1" << std::endl;
                     print(n->exp1, level + 2, os);
@@ -1455,7 +1523,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_triop_t>(node);
+                    auto n = dynamic_cast<sym_triop_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "exp1" << std::endl;
                     print(n->exp1, level + 2, os);
@@ -1486,7 +1554,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_member_dot_t>(node);
+                    auto n = dynamic_cast<sym_member_dot_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "exp" << std::endl;
                     print(n->exp, level + 2, os);
@@ -1507,7 +1575,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_member_index_t>(node);
+                    auto n = dynamic_cast<sym_member_index_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "exp" << std::endl;
                     print(n->exp, level + 2, os);
@@ -1523,7 +1591,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_exp_seq_t>(node);
+                    auto n = dynamic_cast<sym_exp_seq_t *>(node);
                     for (const auto &s : n->exps) {
                         print(s, level + 1, os);
                     }
@@ -1536,7 +1604,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_array_t>(node);
+                    auto n = dynamic_cast<sym_array_t *>(node);
                     for (const auto &s : n->exps) {
                         if (s)
                             print(s, level + 1, os);
@@ -1554,7 +1622,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_object_t>(node);
+                    auto n = dynamic_cast<sym_object_t *>(node);
                     for (const auto &s : n->pairs) {
                         print(s, level + 1, os);
                     }
@@ -1567,7 +1635,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_object_pair_t>(node);
+                    auto n = dynamic_cast<sym_object_pair_t *>(node);
                     print(n->key, level + 1, os);
                     print(n->value, level + 1, os);
                 }
@@ -1579,16 +1647,21 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_call_method_t>(node);
+                    auto n = dynamic_cast<sym_call_method_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "obj" << std::endl;
                     print(n->obj, level + 2, os);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
-                    os << "method: " << n->method->data._identifier
-                       << " " << "[" << n->method->line << ":"
-                       << n->method->column << ":"
-                       << n->method->start << ":"
-                       << n->method->end << "]" << std::endl;
+                    if (n->method) {
+                        os << "method: " << n->method->data._identifier
+                           << " " << "[" << n->method->line << ":"
+                           << n->method->column << ":"
+                           << n->method->start << ":"
+                           << n->method->end << "]" << std::endl;
+                    } else {
+                        os << "index" << std::endl;
+                        print(n->index, level + 2, os);
+                    }
                     if (!n->args.empty()) {
                         os << std::setfill(' ') << std::setw(level + 1) << "";
                         os << "args" << std::endl;
@@ -1605,7 +1678,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_call_function_t>(node);
+                    auto n = dynamic_cast<sym_call_function_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "obj" << std::endl;
                     print(n->obj, level + 2, os);
@@ -1625,7 +1698,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_new_t>(node);
+                    auto n = dynamic_cast<sym_new_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "obj" << std::endl;
                     print(n->obj, level + 2, os);
@@ -1649,7 +1722,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_var_t>(node);
+                    auto n = dynamic_cast<sym_stmt_var_t *>(node);
                     for (const auto &s : n->vars) {
                         print(s, level + 1, os);
                     }
@@ -1662,7 +1735,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_exp_t>(node);
+                    auto n = dynamic_cast<sym_stmt_exp_t *>(node);
                     print(n->seq, level + 1, os);
                 }
                 break;
@@ -1673,7 +1746,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_return_t>(node);
+                    auto n = dynamic_cast<sym_stmt_return_t *>(node);
                     if (n->seq)
                         print(n->seq, level + 1, os);
                 }
@@ -1685,13 +1758,13 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_throw_t>(node);
+                    auto n = dynamic_cast<sym_stmt_throw_t *>(node);
                     if (n->seq)
                         print(n->seq, level + 1, os);
                 }
                 break;
             case s_statement_control: {
-                auto n = std::dynamic_pointer_cast<sym_stmt_control_t>(node);
+                auto n = dynamic_cast<sym_stmt_control_t *>(node);
                 os << "statement_" << lexer_string(lexer_t(n->keyword))
                    << " " << "[" << node->line << ":"
                    << node->column << ":"
@@ -1708,7 +1781,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_if_t>(node);
+                    auto n = dynamic_cast<sym_stmt_if_t *>(node);
                     print(n->seq, level + 1, os);
                     print(n->true_stmt, level + 1, os);
                     if (n->false_stmt)
@@ -1722,7 +1795,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_while_t>(node);
+                    auto n = dynamic_cast<sym_stmt_while_t *>(node);
                     print(n->seq, level + 1, os);
                     print(n->stmt, level + 1, os);
                 }
@@ -1734,7 +1807,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_for_t>(node);
+                    auto n = dynamic_cast<sym_stmt_for_t *>(node);
                     if (n->exp)
                         print(n->exp, level + 1, os);
                     else if (n->vars)
@@ -1753,7 +1826,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_for_in_t>(node);
+                    auto n = dynamic_cast<sym_stmt_for_in_t *>(node);
                     if (n->exp)
                         print(n->exp, level + 1, os);
                     else
@@ -1769,7 +1842,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_case_t>(node);
+                    auto n = dynamic_cast<sym_case_t *>(node);
                     if (n->exp)
                         print(n->exp, level + 1, os);
                     for (const auto &s : n->stmts) {
@@ -1784,7 +1857,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_switch_t>(node);
+                    auto n = dynamic_cast<sym_stmt_switch_t *>(node);
                     print(n->exp, level + 1, os);
                     for (const auto &s : n->cases) {
                         print(s, level + 1, os);
@@ -1798,7 +1871,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_stmt_try_t>(node);
+                    auto n = dynamic_cast<sym_stmt_try_t *>(node);
                     os << std::setfill(' ') << std::setw(level + 1) << "";
                     os << "try" << std::endl;
                     print(n->try_body, level + 2, os);
@@ -1823,7 +1896,7 @@ namespace clib {
                    << node->column << ":"
                    << node->start << ":"
                    << node->end << "]" << std::endl;
-                for (const auto &s : std::dynamic_pointer_cast<sym_block_t>(node)->stmts) {
+                for (const auto &s : dynamic_cast<sym_block_t *>(node)->stmts) {
                     print(s, level + 1, os);
                 }
                 break;
@@ -1834,7 +1907,7 @@ namespace clib {
                    << node->start << ":"
                    << node->end << "]" << std::endl;
                 {
-                    auto n = std::dynamic_pointer_cast<sym_code_t>(node);
+                    auto n = dynamic_cast<sym_code_t *>(node);
                     if (n->name) {
                         os << std::setfill(' ') << std::setw(level + 1) << "";
                         os << "name: " << n->name->data._identifier
@@ -1932,11 +2005,11 @@ namespace clib {
         codes.pop_back();
     }
 
-    void cjsgen::enter(int type, sym_t::ref s) {
+    void cjsgen::enter(int type, sym_t *s) {
         codes.back()->scopes.emplace_back();
         codes.back()->scopes.back().type = (cjs_scope_t) type;
         if (s)
-            codes.back()->scopes.back().sym = std::move(s);
+            codes.back()->scopes.back().sym = s;
     }
 
     void cjsgen::leave() {
@@ -1966,14 +2039,14 @@ namespace clib {
         return codes.back()->scopes.back().rewrites;
     }
 
-    std::shared_ptr<sym_t> cjsgen::get_var(const std::string &name, int t) {
+    sym_t *cjsgen::get_var(const std::string &name, int t) {
         auto type = (cjs_scope_query_t) t;
         switch (type) {
             case sq_local: {
                 const auto &vars = codes.back()->scopes.back().vars;
                 auto f = vars.find(name);
                 if (f != vars.end()) {
-                    return f->second.lock();
+                    return f->second;
                 }
                 return nullptr;
             }
@@ -1983,7 +2056,7 @@ namespace clib {
                     const auto &vars = s->vars;
                     auto f = vars.find(name);
                     if (f != vars.end()) {
-                        return f->second.lock();
+                        return f->second;
                     }
                 }
                 const auto &args = codes.back()->args;
@@ -2001,7 +2074,7 @@ namespace clib {
                         const auto &vars = s->vars;
                         auto f = vars.find(name);
                         if (f != vars.end()) {
-                            return f->second.lock();
+                            return f->second;
                         }
                     }
                     const auto &args = (*i)->args;
@@ -2019,11 +2092,11 @@ namespace clib {
         return nullptr;
     }
 
-    void cjsgen::add_var(const std::string &name, std::shared_ptr<sym_t> id) {
+    void cjsgen::add_var(const std::string &name, sym_t *id) {
         codes.back()->scopes.back().vars[name] = id;
     }
 
-    void cjsgen::add_closure(std::shared_ptr<sym_var_id_t> c) {
+    void cjsgen::add_closure(sym_var_id_t *c) {
         auto name = std::string(c->node->data._identifier);
         for (auto i = codes.rbegin(); i != codes.rend(); i++) {
             if ((*i)->closure_str.find(name) != (*i)->closure_str.end())
@@ -2052,7 +2125,7 @@ namespace clib {
                 break;
             }
             (*i)->closure_str.insert(name);
-            (*i)->closure.push_back(c);
+            (*i)->closure.push_back(c->node);
         }
     }
 
@@ -2100,10 +2173,12 @@ namespace clib {
     void cjsgen::gen_try(int t) {
         auto &scope = codes.back()->scopes;
         std::vector<sym_t::ref> f;
+        auto n = 0;
         if (t == K_RETURN) {
             for (auto s = scope.rbegin(); s != scope.rend(); s++) {
-                if ((s->type == sp_try ||
-                    s->type == sp_catch) && s->sym) {
+                if (s->type == sp_try ||
+                    s->type == sp_catch) {
+                    n++;
                     auto sym = s->sym;
                     if (sym) {
                         f.push_back(sym);
@@ -2121,8 +2196,9 @@ namespace clib {
                     s->type == sp_switch ||
                     s->type == sp_finally)
                     break;
-                if ((s->type == sp_try ||
-                     s->type == sp_catch) && s->sym) {
+                if (s->type == sp_try ||
+                    s->type == sp_catch) {
+                    n++;
                     auto sym = s->sym;
                     if (sym) {
                         f.push_back(sym);
@@ -2137,8 +2213,9 @@ namespace clib {
                     s->type == sp_do_while ||
                     s->type == sp_finally)
                     break;
-                if ((s->type == sp_try ||
-                     s->type == sp_catch) && s->sym) {
+                if (s->type == sp_try ||
+                    s->type == sp_catch) {
+                    n++;
                     auto sym = s->sym;
                     if (sym) {
                         f.push_back(sym);
@@ -2146,10 +2223,10 @@ namespace clib {
                 }
             }
         }
+        for (auto i = 0; i < n; i++) {
+            emit(nullptr, EXIT_FINALLY);
+        }
         if (!f.empty()) {
-            for (size_t i = 0; i < f.size(); i++) {
-                emit(nullptr, EXIT_FINALLY);
-            }
             enter(sp_finally);
             for (auto s = f.rbegin(); s != f.rend(); s++) {
                 (*s)->gen_rvalue(*this);
@@ -2166,6 +2243,294 @@ namespace clib {
         throw cexception(ss.str());
     }
 
+    static int jump_type(int code) {
+        switch (code) {
+            case JUMP_IF_TRUE_OR_POP:
+            case JUMP_IF_FALSE_OR_POP:
+            case POP_JUMP_IF_TRUE:
+            case POP_JUMP_IF_FALSE:
+            case JUMP_ABSOLUTE:
+            case COMPARE_JUMP_IF_FALSE:
+                return 1; // 绝对跳转
+            case FOR_ITER:
+            case JUMP_FORWARD:
+            case POP_FINALLY:
+                return 2; // 相对跳转
+            default:
+                return 0;
+        }
+    }
+
+    // 统一换算为绝对地址，SETUP_FINALLY的两个出口分别记在target/target2
+    static void decode_jumps(const std::vector<cjs_code> &codes, std::vector<int> &target, std::vector<int> &target2) {
+        auto n = (int) codes.size();
+        target.assign(n, -1);
+        target2.assign(n, -1);
+        for (auto i = 0; i < n; i++) {
+            const auto &c = codes[i];
+            auto t = jump_type(c.code);
+            if (t == 1)
+                target[i] = c.op1;
+            else if (t == 2)
+                target[i] = i + c.op1;
+            else if (c.code == SETUP_FINALLY) {
+                if (c.op1 != 0)
+                    target[i] = i + c.op1;
+                if (c.op2 != 0)
+                    target2[i] = i + c.op2;
+            }
+        }
+    }
+
+    // 只保留keep的指令并重定位跳转
+    static void compact_codes(std::vector<cjs_code> &codes, const std::vector<int> &target,
+                              const std::vector<int> &target2, const std::vector<bool> &keep) {
+        auto n = (int) codes.size();
+        std::vector<int> addr(n + 1);
+        auto m = 0;
+        for (auto i = 0; i < n; i++) {
+            addr[i] = m;
+            if (keep[i])
+                m++;
+        }
+        addr[n] = m;
+        auto last = -1;
+        for (auto i = 0, j = 0; i < n; i++) {
+            if (!keep[i])
+                continue;
+            auto &c = codes[i];
+            auto t = jump_type(c.code);
+            if (t == 1)
+                c.op1 = addr[target[i]];
+            else if (t == 2)
+                c.op1 = addr[target[i]] - j;
+            else if (c.code == SETUP_FINALLY) {
+                if (target[i] != -1)
+                    c.op1 = addr[target[i]] - j;
+                if (target2[i] != -1)
+                    c.op2 = addr[target2[i]] - j;
+            }
+            last = i;
+            if (i != j)
+                codes[j] = std::move(c);
+            j++;
+        }
+        codes.resize(m);
+        // 末尾的POP_TOP会被当作返回值，不能因删除代码而改变
+        if (last != n - 1 && !codes.empty() && codes.back().code == POP_TOP)
+            codes.push_back({0, 0, 0, 0, NOP, 0, 0, 0});
+    }
+
+    // 分支折叠、跳转串联、删除不可达代码
+    void cjsgen::optimize(std::vector<cjs_code> &codes) {
+        auto n = (int) codes.size();
+        if (n == 0)
+            return;
+        std::vector<int> target, target2;
+        decode_jumps(codes, target, target2);
+        std::vector<bool> labeled(n + 1, false);
+        for (auto i = 0; i < n; i++) {
+            if (target[i] != -1)
+                labeled[target[i]] = true;
+            if (target2[i] != -1)
+                labeled[target2[i]] = true;
+        }
+        auto to_nop = [&](int i) {
+            codes[i].code = NOP;
+            codes[i].opnum = 0;
+            codes[i].op1 = codes[i].op2 = 0;
+            target[i] = -1;
+        };
+        // 条件为常量的分支
+        for (auto i = 0; i + 1 < n; i++) {
+            bool cond;
+            switch (codes[i].code) {
+                case LOAD_TRUE:
+                    cond = true;
+                    break;
+                case LOAD_FALSE:
+                case LOAD_NULL:
+                case LOAD_UNDEFINED:
+                case LOAD_ZERO:
+                    cond = false;
+                    break;
+                default:
+                    continue;
+            }
+            if (labeled[i + 1])
+                continue;
+            auto &c = codes[i + 1];
+            bool jump, pop;
+            switch (c.code) {
+                case POP_JUMP_IF_TRUE:
+                    jump = cond;
+                    pop = true;
+                    break;
+                case POP_JUMP_IF_FALSE:
+                    jump = !cond;
+                    pop = true;
+                    break;
+                case JUMP_IF_TRUE_OR_POP:
+                    jump = cond;
+                    pop = !jump;
+                    break;
+                case JUMP_IF_FALSE_OR_POP:
+                    jump = !cond;
+                    pop = !jump;
+                    break;
+                default:
+                    continue;
+            }
+            if (jump) {
+                c.code = JUMP_ABSOLUTE;
+                if (pop)
+                    to_nop(i);
+            } else {
+                to_nop(i + 1);
+                if (pop)
+                    to_nop(i);
+            }
+        }
+        // 跳转到无条件跳转的，直接跳到最终目标
+        auto follow = [&](int t) {
+            for (auto k = 0; k < n && t < n; k++) {
+                if (codes[t].code == NOP)
+                    t++;
+                else if (codes[t].code == JUMP_ABSOLUTE || codes[t].code == JUMP_FORWARD)
+                    t = target[t];
+                else
+                    break;
+            }
+            return t;
+        };
+        for (auto i = 0; i < n; i++) {
+            if (target[i] == -1 || codes[i].code == SETUP_FINALLY)
+                continue;
+            target[i] = follow(target[i]);
+            if ((codes[i].code == JUMP_ABSOLUTE || codes[i].code == JUMP_FORWARD) && target[i] == follow(i + 1))
+                to_nop(i);
+        }
+        // 可达性分析
+        std::vector<bool> live(n, false);
+        std::vector<int> work{0};
+        while (!work.empty()) {
+            auto i = work.back();
+            work.pop_back();
+            while (i < n && !live[i]) {
+                live[i] = true;
+                if (target[i] != -1)
+                    work.push_back(target[i]);
+                if (target2[i] != -1)
+                    work.push_back(target2[i]);
+                auto code = codes[i].code;
+                if (code == JUMP_ABSOLUTE || code == JUMP_FORWARD || code == POP_FINALLY ||
+                    code == RETURN_VALUE || code == THROW)
+                    break;
+                i++;
+            }
+        }
+        for (auto i = 0; i < n; i++) {
+            if (codes[i].code == NOP)
+                live[i] = false;
+            else if (codes[i].code == JUMP_ABSOLUTE)
+                codes[i].opnum = 1;
+        }
+        compact_codes(codes, target, target2, live);
+#if PEEPHOLE_CODE
+        peephole(codes);
+#endif
+    }
+
+    // 常见指令序列合并为一条，减少分派次数
+    void cjsgen::peephole(std::vector<cjs_code> &codes) {
+        auto n = (int) codes.size();
+        std::vector<int> target, target2;
+        decode_jumps(codes, target, target2);
+        std::vector<bool> labeled(n + 1, false);
+        for (auto i = 0; i < n; i++) {
+            if (target[i] != -1)
+                labeled[target[i]] = true;
+            if (target2[i] != -1)
+                labeled[target2[i]] = true;
+        }
+        std::vector<bool> keep(n, true);
+        // 从i开始的k条指令依次为ins，且后面几条不是跳转目标；末尾的POP_TOP不参与合并
+        auto match = [&](int i, std::initializer_list<int> ins) {
+            auto k = (int) ins.size();
+            if (i + k > n)
+                return false;
+            auto j = i;
+            for (auto c : ins) {
+                if (c != -1 && codes[j].code != c)
+                    return false;
+                if (j > i && labeled[j])
+                    return false;
+                j++;
+            }
+            return !(i + k == n && codes[n - 1].code == POP_TOP);
+        };
+        auto fuse = [&](int i, int k, ins_t code, int op1, int op2, int pos) {
+            auto &c = codes[i];
+            const auto &p = codes[pos];
+            c.line = p.line;
+            c.column = p.column;
+            c.start = p.start;
+            c.end = p.end;
+            c.code = code;
+            c.opnum = 2;
+            c.op1 = op1;
+            c.op2 = op2;
+            for (auto j = i + 1; j < i + k; j++)
+                keep[j] = false;
+        };
+        for (auto i = 0; i < n; i++) {
+            const auto &c = codes[i];
+            if (c.code == LOAD_FAST) {
+                // x++ / x-- / ++x / --x
+                if (match(i, {LOAD_FAST, DUP_TOP, -1, STORE_FAST, POP_TOP}) &&
+                    (codes[i + 2].code == BINARY_INC || codes[i + 2].code == BINARY_DEC) &&
+                    codes[i + 3].op1 == c.op1) {
+                    auto code = codes[i + 2].code == BINARY_INC ? INC_FAST : DEC_FAST;
+                    if (match(i, {LOAD_FAST, DUP_TOP, -1, STORE_FAST, POP_TOP, POP_TOP}))
+                        fuse(i, 6, code, c.op1, 2, i + 2);
+                    else
+                        fuse(i, 5, code, c.op1, 0, i + 2);
+                } else if (match(i, {LOAD_FAST, -1, STORE_FAST}) &&
+                           (codes[i + 1].code == BINARY_INC || codes[i + 1].code == BINARY_DEC) &&
+                           codes[i + 2].op1 == c.op1) {
+                    auto code = codes[i + 1].code == BINARY_INC ? INC_FAST : DEC_FAST;
+                    if (match(i, {LOAD_FAST, -1, STORE_FAST, POP_TOP}))
+                        fuse(i, 4, code, c.op1, 2, i + 1);
+                    else
+                        fuse(i, 3, code, c.op1, 1, i + 1);
+                } else if (match(i, {LOAD_FAST, LOAD_ATTR})) {
+                    fuse(i, 2, LOAD_FAST_ATTR, c.op1, codes[i + 1].op1, i + 1);
+                } else if (match(i, {LOAD_FAST, LOAD_FAST})) {
+                    fuse(i, 2, LOAD_FAST_FAST, c.op1, codes[i + 1].op1, i + 1);
+                } else {
+                    continue;
+                }
+            } else if (c.code == STORE_FAST) {
+                if (match(i, {STORE_FAST, POP_TOP})) {
+                    fuse(i, 2, STORE_FAST_POP, c.op1, 0, i);
+                    codes[i].opnum = 1;
+                } else
+                    continue;
+            } else if (c.code >= COMPARE_LESS && c.code <= COMPARE_FNOT_EQUAL) {
+                if (match(i, {-1, POP_JUMP_IF_FALSE}))
+                    fuse(i, 2, COMPARE_JUMP_IF_FALSE, target[i + 1], c.code, i);
+                else
+                    continue;
+                target[i] = target[i + 1];
+            } else {
+                continue;
+            }
+            while (i + 1 < n && !keep[i + 1])
+                i++;
+        }
+        compact_codes(codes, target, target2, keep);
+    }
+
     void cjsgen::dump() const {
 #if PRINT_CODE && DEBUG_MODE
         fprintf(stdout, "--== Main Function ==--\n");
@@ -2185,7 +2550,7 @@ namespace clib {
 
     void cjsgen::dump(sym_code_t::ref code, bool print) const {
         if (print)
-            code->consts.dump(text);
+            code->consts.dump(text.get());
         auto idx = 0;
         std::vector<int> jumps;
         {
@@ -2197,11 +2562,13 @@ namespace clib {
                     case POP_JUMP_IF_TRUE:
                     case POP_JUMP_IF_FALSE:
                     case JUMP_ABSOLUTE:
+                    case COMPARE_JUMP_IF_FALSE:
                         jumps_set.insert(c.op1);
                         break;
                     case FOR_ITER:
                     case JUMP_FORWARD:
                     case SETUP_FINALLY:
+                    case POP_FINALLY:
                         jumps_set.insert(idx + c.op1);
                         break;
                     default:
@@ -11,8 +11,11 @@
 #include <memory>
 #include <unordered_set>
 #include "cjsast.h"
+#include "cjssource.h"
 
 #define LAMBDA_ID "<lambda>"
+#define SYM_ARENA_BLOCK (1U << 16U)
+#define SYM_ARENA_MIN_BLOCK (1U << 10U)
 
 namespace clib {
 
@@ -72,13 +75,13 @@ namespace clib {
         virtual int load_string(const std::string &, int) = 0;
         virtual int push_function(std::shared_ptr<sym_code_t>) = 0;
         virtual void pop_function() = 0;
-        virtual void enter(int, std::shared_ptr<sym_t> = nullptr) = 0;
+        virtual void enter(int, sym_t * = nullptr) = 0;
         virtual void leave() = 0;
         virtual void push_rewrites(int index, int type) = 0;
         virtual const std::unordered_map<int, int> &get_rewrites() = 0;
-        virtual std::shared_ptr<sym_t> get_var(const std::string &, int) = 0;
-        virtual void add_var(const std::string &, std::shared_ptr<sym_t>) = 0;
-        virtual void add_closure(std::shared_ptr<sym_var_id_t>) = 0;
+        virtual sym_t *get_var(const std::string &, int) = 0;
+        virtual void add_var(const std::string &, sym_t *) = 0;
+        virtual void add_closure(sym_var_id_t *) = 0;
         virtual int get_func_level() const = 0;
         virtual std::string get_func_name() const = 0;
         virtual std::string get_fullname(const std::string &name) const = 0;
@@ -89,10 +92,11 @@ namespace clib {
         virtual void error(ast_node_index *, const std::string &) const = 0;
     };
 
-    class sym_t : public ast_node_index, public std::enable_shared_from_this<sym_t> {
+    class sym_t : public ast_node_index {
     public:
-        using ref = std::shared_ptr<sym_t>;
-        using weak_ref = std::weak_ptr<sym_t>;
+        using ref = sym_t *;
+        using weak_ref = sym_t *;
+        virtual ~sym_t() = default;
         virtual symbol_t get_type() const;
         virtual symbol_t get_base_type() const;
         virtual std::string to_string() const;
@@ -103,6 +107,32 @@ namespace clib {
         weak_ref parent;
     };
 
+    // 符号节点分配区：每个函数一个，函数体生成字节码后整体析构
+    class sym_arena {
+    public:
+        sym_arena() = default;
+        ~sym_arena();
+
+        sym_arena(const sym_arena &) = delete;
+        sym_arena &operator=(const sym_arena &) = delete;
+
+        template<class T, class... Args>
+        T *make(Args &&... args) {
+            auto p = new(alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            nodes.push_back(p);
+            return p;
+        }
+
+    private:
+        char *alloc(size_t size, size_t align);
+
+        std::vector<std::unique_ptr<char[]>> blocks;
+        size_t used{0};
+        size_t capacity{0};
+        size_t next{SYM_ARENA_MIN_BLOCK};
+        std::vector<sym_t *> nodes;
+    };
+
     enum sym_lvalue_t {
         no_lvalue,
         can_be_lvalue,
@@ -110,14 +140,14 @@ namespace clib {
 
     class sym_exp_t : public sym_t {
     public:
-        using ref = std::shared_ptr<sym_exp_t>;
+        using ref = sym_exp_t *;
         symbol_t get_type() const override;
         symbol_t get_base_type() const override;
     };
 
     class sym_var_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_var_t>;
+        using ref = sym_var_t *;
         explicit sym_var_t(ast_node *node);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -134,7 +164,7 @@ namespace clib {
 
     class sym_var_id_t : public sym_var_t {
     public:
-        using ref = std::shared_ptr<sym_var_id_t>;
+        using ref = sym_var_id_t *;
         explicit sym_var_id_t(ast_node *node, const sym_t::ref &symbol);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -148,7 +178,7 @@ namespace clib {
 
     class sym_id_t : public sym_t {
     public:
-        using ref = std::shared_ptr<sym_id_t>;
+        using ref = sym_id_t *;
         symbol_t get_type() const override;
         symbol_t get_base_type() const override;
         std::string to_string() const override;
@@ -156,14 +186,14 @@ namespace clib {
         int gen_rvalue(ijsgen &gen) override;
         int gen_rvalue_decl(ijsgen &gen);
         int set_parent(sym_t::ref node) override;
-        void parse();
+        void parse(sym_arena &syms);
         std::vector<sym_var_t::ref> ids;
         sym_exp_t::ref init;
     };
 
     class sym_unop_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_unop_t>;
+        using ref = sym_unop_t *;
         explicit sym_unop_t(sym_exp_t::ref exp, ast_node *op);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -176,7 +206,7 @@ namespace clib {
 
     class sym_sinop_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_sinop_t>;
+        using ref = sym_sinop_t *;
         explicit sym_sinop_t(sym_exp_t::ref exp, ast_node *op);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -189,7 +219,7 @@ namespace clib {
 
     class sym_binop_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_binop_t>;
+        using ref = sym_binop_t *;
         explicit sym_binop_t(sym_exp_t::ref exp1, sym_exp_t::ref exp2, ast_node *op);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -202,7 +232,7 @@ namespace clib {
 
     class sym_triop_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_triop_t>;
+        using ref = sym_triop_t *;
         explicit sym_triop_t(sym_exp_t::ref exp1, sym_exp_t::ref exp2,
                              sym_exp_t::ref exp3, ast_node *op1, ast_node *op2);
         symbol_t get_type() const override;
@@ -216,7 +246,7 @@ namespace clib {
 
     class sym_member_dot_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_member_dot_t>;
+        using ref = sym_member_dot_t *;
         explicit sym_member_dot_t(sym_exp_t::ref exp);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -229,7 +259,7 @@ namespace clib {
 
     class sym_member_index_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_member_index_t>;
+        using ref = sym_member_index_t *;
         explicit sym_member_index_t(sym_exp_t::ref exp);
         symbol_t get_type() const override;
         std::string to_string() const override;
@@ -242,7 +272,7 @@ namespace clib {
 
     class sym_exp_seq_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_exp_seq_t>;
+        using ref = sym_exp_seq_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -252,7 +282,7 @@ namespace clib {
 
     class sym_array_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_array_t>;
+        using ref = sym_array_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -263,7 +293,7 @@ namespace clib {
 
     class sym_object_pair_t : public sym_t {
     public:
-        using ref = std::shared_ptr<sym_object_pair_t>;
+        using ref = sym_object_pair_t *;
         symbol_t get_type() const override;
         symbol_t get_base_type() const override;
         std::string to_string() const override;
@@ -274,7 +304,7 @@ namespace clib {
 
     class sym_new_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_new_t>;
+        using ref = sym_new_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -286,7 +316,7 @@ namespace clib {
 
     class sym_object_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_object_t>;
+        using ref = sym_object_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -298,20 +328,21 @@ namespace clib {
 
     class sym_call_method_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_call_method_t>;
+        using ref = sym_call_method_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
         int set_parent(sym_t::ref node) override;
         sym_exp_t::ref obj;
         ast_node *method{nullptr};
+        sym_exp_t::ref index;
         std::vector<sym_exp_t::ref> args;
         std::vector<int> rests;
     };
 
     class sym_call_function_t : public sym_exp_t {
     public:
-        using ref = std::shared_ptr<sym_call_function_t>;
+        using ref = sym_call_function_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -323,7 +354,7 @@ namespace clib {
 
     class sym_stmt_t : public sym_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_t>;
+        using ref = sym_stmt_t *;
         symbol_t get_type() const override;
         symbol_t get_base_type() const override;
         std::string to_string() const override;
@@ -332,7 +363,7 @@ namespace clib {
 
     class sym_stmt_var_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_var_t>;
+        using ref = sym_stmt_var_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -342,7 +373,7 @@ namespace clib {
 
     class sym_stmt_exp_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_exp_t>;
+        using ref = sym_stmt_exp_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -352,7 +383,7 @@ namespace clib {
 
     class sym_stmt_return_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_return_t>;
+        using ref = sym_stmt_return_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -362,7 +393,7 @@ namespace clib {
 
     class sym_stmt_throw_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_throw_t>;
+        using ref = sym_stmt_throw_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -372,7 +403,7 @@ namespace clib {
 
     class sym_stmt_control_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_control_t>;
+        using ref = sym_stmt_control_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -383,7 +414,7 @@ namespace clib {
 
     class sym_stmt_if_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_if_t>;
+        using ref = sym_stmt_if_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -395,7 +426,7 @@ namespace clib {
 
     class sym_stmt_while_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_while_t>;
+        using ref = sym_stmt_while_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -407,7 +438,7 @@ namespace clib {
 
     class sym_stmt_for_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_for_t>;
+        using ref = sym_stmt_for_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -421,7 +452,7 @@ namespace clib {
 
     class sym_stmt_for_in_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_for_in_t>;
+        using ref = sym_stmt_for_in_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -434,7 +465,7 @@ namespace clib {
 
     class sym_case_t : public sym_t {
     public:
-        using ref = std::shared_ptr<sym_case_t>;
+        using ref = sym_case_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -445,7 +476,7 @@ namespace clib {
 
     class sym_stmt_switch_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_switch_t>;
+        using ref = sym_stmt_switch_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -456,7 +487,7 @@ namespace clib {
 
     class sym_stmt_try_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_stmt_try_t>;
+        using ref = sym_stmt_try_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -469,7 +500,7 @@ namespace clib {
 
     class sym_block_t : public sym_stmt_t {
     public:
-        using ref = std::shared_ptr<sym_block_t>;
+        using ref = sym_block_t *;
         symbol_t get_type() const override;
         std::string to_string() const override;
         int gen_rvalue(ijsgen &gen) override;
@@ -497,7 +528,7 @@ namespace clib {
         char *get_data(int n) const;
         const char *get_name(int n) const;
         const char *get_global(int n) const;
-        void dump(const std::string *text) const;
+        void dump(const cjs_source *text) const;
         void save();
         const std::vector<char *> &get_consts_data() const;
         const std::vector<const char *> &get_names_data() const;
@@ -510,7 +541,7 @@ namespace clib {
         std::unordered_map<std::string, int> globals;
         std::unordered_map<std::string, int> derefs;
         std::unordered_map<std::string, int> names;
-        std::unordered_map<int, std::weak_ptr<sym_code_t>> functions;
+        std::unordered_map<int, std::shared_ptr<sym_code_t>> functions;
         std::vector<runtime_t> consts;
         std::vector<char *> consts_data;
         std::vector<const char *> names_data;
@@ -555,7 +586,7 @@ namespace clib {
         std::string desc;
     };
 
-    class sym_code_t : public sym_exp_t {
+    class sym_code_t : public sym_exp_t, public std::enable_shared_from_this<sym_code_t> {
     public:
         using ref = std::shared_ptr<sym_code_t>;
         using weak_ref = std::weak_ptr<sym_code_t>;
@@ -569,14 +600,17 @@ namespace clib {
         std::string fullName;
         std::string simpleName;
         std::string debugName;
-        std::string text;
+        std::string debugFile;
+        std::string debugLabel;
+        cjs_source::ref source;
         std::vector<sym_var_t::ref> args;
         std::vector<std::string> args_str;
         sym_t::ref body;
+        std::unique_ptr<sym_arena> syms; // 函数体的符号节点
         cjs_consts consts;
         std::vector<cjs_scope> scopes;
         std::vector<cjs_code> codes;
-        std::vector<sym_var_id_t::ref> closure;
+        std::vector<ast_node *> closure;
         std::unordered_set<std::string> closure_str;
     };
 
@@ -594,7 +628,7 @@ namespace clib {
         cjsgen(const cjsgen &) = delete;
         cjsgen &operator=(const cjsgen &) = delete;
 
-        bool gen_code(ast_node *node, const std::string *str, const std::string &name);
+        bool gen_code(ast_node *node, const cjs_source::ref &src, const std::string &name);
         cjs_code_result::ref get_code() const;
 
         static void print(const sym_t::ref &node, int level, std::ostream &os);
@@ -609,13 +643,13 @@ namespace clib {
         int load_string(const std::string &, int) override;
         int push_function(std::shared_ptr<sym_code_t>) override;
         void pop_function() override;
-        void enter(int, sym_t::ref = nullptr) override;
+        void enter(int, sym_t * = nullptr) override;
         void leave() override;
         void push_rewrites(int index, int type) override;
         const std::unordered_map<int, int> &get_rewrites() override;
-        std::shared_ptr<sym_t> get_var(const std::string &, int) override;
-        void add_var(const std::string &, std::shared_ptr<sym_t>) override;
-        void add_closure(std::shared_ptr<sym_var_id_t>) override;
+        sym_t *get_var(const std::string &, int) override;
+        void add_var(const std::string &, sym_t *) override;
+        void add_closure(sym_var_id_t *) override;
         int get_func_level() const override;
         std::string get_fullname(const std::string &name) const override;
         std::string get_func_name() const override;
@@ -637,14 +671,22 @@ namespace clib {
         sym_exp_t::ref to_exp(const sym_t::ref& s);
         sym_stmt_t::ref to_stmt(const sym_t::ref& s);
 
+        sym_code_t *new_code();
+        template<class T, class... Args>
+        T *make(Args &&... args) { return arenas.back()->make<T>(std::forward<Args>(args)...); }
         sym_t::ref find_symbol(ast_node *node);
         sym_var_t::ref primary_node(ast_node *node);
 
+        static void optimize(std::vector<cjs_code> &codes);
+        static void peephole(std::vector<cjs_code> &codes);
+
         void dump() const;
         void dump(sym_code_t::ref, bool print) const;
 
     private:
-        const std::string *text{nullptr};
+        std::vector<std::unique_ptr<sym_arena>> arenas;
+        std::vector<sym_code_t::ref> decls;
+        cjs_source::ref text;
         std::string filename;
         std::vector<std::string> err;
         std::vector<std::vector<ast_node *>> ast;
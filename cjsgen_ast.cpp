@@ -11,8 +11,195 @@
 #include "cjsgen.h"
 #include "cjsast.h"
 
+#define FOLD_CONST 1
+
 namespace clib {
 
+    static void gen_number(ijsgen &gen, ast_node_index *idx, double d) {
+        if (d != 0) {
+            gen.emit(idx, LOAD_CONST, gen.load_number(d));
+        } else {
+            if (std::signbit(d) == 0)
+                gen.emit(idx, LOAD_ZERO, 0);
+            else
+                gen.emit(idx, LOAD_ZERO, 1);
+        }
+    }
+
+#if FOLD_CONST
+    // 常量折叠，只处理数字字面量，运算规则与运行时binop一致
+    static bool fold_number(sym_t *s, double &d) {
+        switch (s->get_type()) {
+            case s_var: {
+                auto node = dynamic_cast<sym_var_t *>(s)->node;
+                if (node->flag != a_number)
+                    return false;
+                d = node->data._number;
+                return true;
+            }
+            case s_unop: {
+                auto u = dynamic_cast<sym_unop_t *>(s);
+                if (u->op->flag != a_operator)
+                    return false;
+                if (u->op->data._op != T_ADD && u->op->data._op != T_SUB)
+                    return false;
+                if (!fold_number(u->exp, d))
+                    return false;
+                if (u->op->data._op == T_SUB)
+                    d = -d;
+                return true;
+            }
+            case s_binop: {
+                auto b = dynamic_cast<sym_binop_t *>(s);
+                if (b->op->flag != a_operator)
+                    return false;
+                switch (b->op->data._op) {
+                    case T_ADD:
+                    case T_SUB:
+                    case T_MUL:
+                    case T_DIV:
+                    case T_MOD:
+                    case T_POWER:
+                        break;
+                    default:
+                        return false;
+                }
+                double s1, s2;
+                if (!fold_number(b->exp2, s2) || !fold_number(b->exp1, s1))
+                    return false;
+                switch (b->op->data._op) {
+                    case T_ADD:
+                        d = s1 + s2;
+                        break;
+                    case T_SUB:
+                        d = s1 - s2;
+                        break;
+                    case T_MUL:
+                        d = s1 * s2;
+                        break;
+                    case T_DIV:
+                        d = s1 / s2;
+                        break;
+                    case T_MOD:
+                        if (std::isinf(s1) || s2 == 0)
+                            d = NAN;
+                        else if (std::isinf(s2))
+                            d = s1;
+                        else if (s1 == 0)
+                            d = std::isnan(s2) ? NAN : s1;
+                        else
+                            d = fmod(s1, s2);
+                        break;
+                    case T_POWER:
+                        if (s2 == 0)
+                            d = 1.0;
+                        else if ((s1 == 1.0 || s1 == -1.0) && std::isinf(s2))
+                            d = NAN;
+                        else
+                            d = pow(s1, s2);
+                        break;
+                    default:
+                        return false;
+                }
+                return true;
+            }
+            default:
+                break;
+        }
+        return false;
+    }
+
+    static bool fold_bool(sym_t *s, bool &b) {
+        switch (s->get_type()) {
+            case s_var: {
+                auto node = dynamic_cast<sym_var_t *>(s)->node;
+                if (node->flag != a_keyword)
+                    return false;
+                if (node->data._keyword != K_TRUE && node->data._keyword != K_FALSE)
+                    return false;
+                b = node->data._keyword == K_TRUE;
+                return true;
+            }
+            case s_unop: {
+                auto u = dynamic_cast<sym_unop_t *>(s);
+                if (u->op->flag != a_operator || u->op->data._op != T_LOG_NOT)
+                    return false;
+                double d;
+                if (fold_bool(u->exp, b))
+                    b = !b;
+                else if (fold_number(u->exp, d))
+                    b = d == 0.0 || std::isnan(d);
+                else
+                    return false;
+                return true;
+            }
+            case s_binop: {
+                auto o = dynamic_cast<sym_binop_t *>(s);
+                if (o->op->flag != a_operator)
+                    return false;
+                switch (o->op->data._op) {
+                    case T_LESS:
+                    case T_LESS_EQUAL:
+                    case T_GREATER:
+                    case T_GREATER_EQUAL:
+                    case T_EQUAL:
+                    case T_NOT_EQUAL:
+                    case T_FEQUAL:
+                    case T_FNOT_EQUAL:
+                        break;
+                    default:
+                        return false;
+                }
+                double s1, s2;
+                if (!fold_number(o->exp2, s2) || !fold_number(o->exp1, s1))
+                    return false;
+                switch (o->op->data._op) {
+                    case T_LESS:
+                        b = s1 < s2;
+                        break;
+                    case T_LESS_EQUAL:
+                        b = s1 <= s2;
+                        break;
+                    case T_GREATER:
+                        b = s1 > s2;
+                        break;
+                    case T_GREATER_EQUAL:
+                        b = s1 >= s2;
+                        break;
+                    case T_EQUAL:
+                    case T_FEQUAL:
+                        b = s1 == s2;
+                        break;
+                    case T_NOT_EQUAL:
+                    case T_FNOT_EQUAL:
+                        b = s1 != s2;
+                        break;
+                    default:
+                        return false;
+                }
+                return true;
+            }
+            default:
+                break;
+        }
+        return false;
+    }
+
+    static bool gen_fold(ijsgen &gen, sym_t *s) {
+        bool b;
+        double d;
+        if (fold_bool(s, b)) {
+            gen.emit(s, b ? LOAD_TRUE : LOAD_FALSE);
+            return true;
+        }
+        if (fold_number(s, d)) {
+            gen_number(gen, s, d);
+            return true;
+        }
+        return false;
+    }
+#endif
+
     symbol_t sym_t::get_type() const {
         return s_sym;
     }
@@ -94,24 +281,24 @@ namespace clib {
 
     int sym_id_t::set_parent(sym_t::ref node) {
         for (auto &s : ids) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         if (init)
-            init->set_parent(shared_from_this());
+            init->set_parent(this);
         return sym_t::set_parent(node);
     }
 
-    void sym_id_t::parse() {
+    void sym_id_t::parse(sym_arena &syms) {
         if (!init)return;
         auto i = init;
         while (i) {
             if (i->get_type() == s_binop) {
-                auto b = std::dynamic_pointer_cast<sym_binop_t>(i);
+                auto b = dynamic_cast<sym_binop_t *>(i);
                 if (b->op->data._op == T_ASSIGN) {
                     auto d = b->exp1;
                     if (d->get_type() == s_var_id) {
-                        auto old_id = std::dynamic_pointer_cast<sym_var_t>(b->exp1);
-                        auto new_id = std::make_shared<sym_var_t>(old_id->node);
+                        auto old_id = dynamic_cast<sym_var_t *>(b->exp1);
+                        auto new_id = syms.make<sym_var_t>(old_id->node);
                         copy_info(new_id, old_id);
                         ids.push_back(new_id);
                         i = b->exp2;
@@ -143,17 +330,17 @@ namespace clib {
             case a_literal:
                 if (clazz == local) {
                     gen.emit(this, STORE_NAME, gen.load_string(node->data._string, cjs_consts::get_string_t::gs_name));
-                    if (parent.lock()->get_type() == s_id) {
+                    if (parent->get_type() == s_id) {
                         if (gen.get_var(node->data._string, sq_local) != nullptr)
                             gen.error(this, "id conflict");
-                        gen.add_var(node->data._string, shared_from_this());
+                        gen.add_var(node->data._string, this);
                     }
                 } else if (clazz == fast) {
                     gen.emit(this, STORE_FAST, gen.load_string(node->data._string, cjs_consts::get_string_t::gs_name));
-                    if (parent.lock()->get_type() == s_id) {
+                    if (parent->get_type() == s_id) {
                         if (gen.get_var(node->data._string, sq_local) != nullptr)
                             gen.error(this, "id conflict");
-                        gen.add_var(node->data._string, shared_from_this());
+                        gen.add_var(node->data._string, this);
                     }
                 } else if (clazz == global) {
                     gen.emit(this, STORE_GLOBAL, gen.load_string(node->data._string, cjs_consts::get_string_t::gs_global));
@@ -189,14 +376,7 @@ namespace clib {
                 gen.emit(this, LOAD_CONST, gen.load_string(node->data._string, cjs_consts::get_string_t::gs_string));
                 break;
             case a_number:
-                if (node->data._number != 0) {
-                    gen.emit(this, LOAD_CONST, gen.load_number(node->data._number));
-                } else {
-                    if (std::signbit(node->data._number) == 0)
-                        gen.emit(this, LOAD_ZERO, 0);
-                    else
-                        gen.emit(this, LOAD_ZERO, 1);
-                }
+                gen_number(gen, this, node->data._number);
                 break;
             case a_regex:
                 gen.emit(this, LOAD_CONST, gen.load_string(node->data._string, cjs_consts::get_string_t::gs_regex));
@@ -265,7 +445,7 @@ namespace clib {
             if (i) {
                 id = i;
                 clazz = closure;
-                gen.add_closure(std::dynamic_pointer_cast<sym_var_id_t>(shared_from_this()));
+                gen.add_closure(dynamic_cast<sym_var_id_t *>(this));
             } else {
                 clazz = global;
             }
@@ -311,6 +491,10 @@ namespace clib {
     }
 
     int sym_unop_t::gen_rvalue(ijsgen &gen) {
+#if FOLD_CONST
+        if (gen_fold(gen, this))
+            return sym_t::gen_rvalue(gen);
+#endif
         exp->gen_rvalue(gen);
         switch (op->data._op) {
             case T_INC:
@@ -366,7 +550,7 @@ namespace clib {
     }
 
     int sym_unop_t::set_parent(sym_t::ref node) {
-        exp->set_parent(shared_from_this());
+        exp->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -413,7 +597,7 @@ namespace clib {
     }
 
     int sym_sinop_t::set_parent(sym_t::ref node) {
-        exp->set_parent(shared_from_this());
+        exp->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -437,6 +621,10 @@ namespace clib {
     }
 
     int sym_binop_t::gen_rvalue(ijsgen &gen) {
+#if FOLD_CONST
+        if (gen_fold(gen, this))
+            return sym_t::gen_rvalue(gen);
+#endif
         if (op->flag == a_keyword) {
             exp1->gen_rvalue(gen);
             exp2->gen_rvalue(gen);
@@ -607,8 +795,8 @@ namespace clib {
     }
 
     int sym_binop_t::set_parent(sym_t::ref node) {
-        exp1->set_parent(shared_from_this());
-        exp2->set_parent(shared_from_this());
+        exp1->set_parent(this);
+        exp2->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -649,9 +837,9 @@ namespace clib {
     }
 
     int sym_triop_t::set_parent(sym_t::ref node) {
-        exp1->set_parent(shared_from_this());
-        exp2->set_parent(shared_from_this());
-        exp3->set_parent(shared_from_this());
+        exp1->set_parent(this);
+        exp2->set_parent(this);
+        exp3->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -691,7 +879,7 @@ namespace clib {
     }
 
     int sym_member_dot_t::set_parent(sym_t::ref node) {
-        exp->set_parent(shared_from_this());
+        exp->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -715,10 +903,10 @@ namespace clib {
         for (const auto &s : indexes) {
             if (i + 1 < indexes.size()) {
                 s->gen_rvalue(gen);
-                gen.emit(s.get(), BINARY_SUBSCR);
+                gen.emit(s, BINARY_SUBSCR);
             } else {
                 s->gen_rvalue(gen);
-                gen.emit(s.get(), STORE_SUBSCR);
+                gen.emit(s, STORE_SUBSCR);
             }
             i++;
         }
@@ -729,15 +917,15 @@ namespace clib {
         exp->gen_rvalue(gen);
         for (const auto &s : indexes) {
             s->gen_rvalue(gen);
-            gen.emit(s.get(), BINARY_SUBSCR);
+            gen.emit(s, BINARY_SUBSCR);
         }
         return sym_t::gen_rvalue(gen);
     }
 
     int sym_member_index_t::set_parent(sym_t::ref node) {
-        exp->set_parent(shared_from_this());
+        exp->set_parent(this);
         for (const auto &s : indexes) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -757,7 +945,7 @@ namespace clib {
         for (const auto &s : exps) {
             s->gen_rvalue(gen);
             if (i + 1 < exps.size())
-                gen.emit(s.get(), POP_TOP);
+                gen.emit(s, POP_TOP);
             i++;
         }
         return sym_t::gen_rvalue(gen);
@@ -799,7 +987,7 @@ namespace clib {
                 else
                     gen.emit(nullptr, LOAD_EMPTY);
                 if (i < rests.size() && rests[i] == j) {
-                    gen.emit(s.get(), UNPACK_SEQUENCE);
+                    gen.emit(s, UNPACK_SEQUENCE);
                     i++;
                 }
                 j++;
@@ -812,7 +1000,7 @@ namespace clib {
     int sym_array_t::set_parent(sym_t::ref node) {
         for (const auto &s : exps) {
             if (s)
-                s->set_parent(shared_from_this());
+                s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -838,8 +1026,8 @@ namespace clib {
     }
 
     int sym_object_pair_t::set_parent(sym_t::ref node) {
-        key->set_parent(shared_from_this());
-        value->set_parent(shared_from_this());
+        key->set_parent(this);
+        value->set_parent(this);
         return sym_t::set_parent(node);
     }
 
@@ -867,7 +1055,7 @@ namespace clib {
             for (const auto &s : args) {
                 s->gen_rvalue(gen);
                 if (i < rests.size() && rests[i] == j) {
-                    gen.emit(s.get(), UNPACK_SEQUENCE);
+                    gen.emit(s, UNPACK_SEQUENCE);
                     i++;
                 }
                 j++;
@@ -878,9 +1066,9 @@ namespace clib {
     }
 
     int sym_new_t::set_parent(sym_t::ref node) {
-        obj->set_parent(shared_from_this());
+        obj->set_parent(this);
         for (const auto &s : args) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -919,10 +1107,10 @@ namespace clib {
 
     int sym_object_t::set_parent(sym_t::ref node) {
         for (const auto &s : pairs) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         for (const auto &s : rests) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -939,7 +1127,12 @@ namespace clib {
 
     int sym_call_method_t::gen_rvalue(ijsgen &gen) {
         obj->gen_rvalue(gen);
-        gen.emit(method, LOAD_METHOD, gen.load_string(method->data._string, cjs_consts::get_string_t::gs_name));
+        if (method) {
+            gen.emit(method, LOAD_METHOD, gen.load_string(method->data._string, cjs_consts::get_string_t::gs_name));
+        } else {
+            index->gen_rvalue(gen);
+            gen.emit(index, LOAD_METHOD, -1);
+        }
         if (rests.empty()) {
             for (const auto &s : args) {
                 s->gen_rvalue(gen);
@@ -952,7 +1145,7 @@ namespace clib {
             for (const auto &s : args) {
                 s->gen_rvalue(gen);
                 if (i < rests.size() && rests[i] == j) {
-                    gen.emit(s.get(), UNPACK_SEQUENCE);
+                    gen.emit(s, UNPACK_SEQUENCE);
                     i++;
                 }
                 j++;
@@ -963,9 +1156,11 @@ namespace clib {
     }
 
     int sym_call_method_t::set_parent(sym_t::ref node) {
-        obj->set_parent(shared_from_this());
+        obj->set_parent(this);
+        if (index)
+            index->set_parent(this);
         for (const auto &s : args) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -994,7 +1189,7 @@ namespace clib {
             for (const auto &s : args) {
                 s->gen_rvalue(gen);
                 if (i < rests.size() && rests[i] == j) {
-                    gen.emit(s.get(), UNPACK_SEQUENCE);
+                    gen.emit(s, UNPACK_SEQUENCE);
                     i++;
                 }
                 j++;
@@ -1005,9 +1200,9 @@ namespace clib {
     }
 
     int sym_call_function_t::set_parent(sym_t::ref node) {
-        obj->set_parent(shared_from_this());
+        obj->set_parent(this);
         for (const auto &s : args) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -1043,14 +1238,14 @@ namespace clib {
     int sym_stmt_var_t::gen_rvalue(ijsgen &gen) {
         for (const auto &s : vars) {
             s->gen_rvalue(gen);
-            gen.emit(s.get(), POP_TOP);
+            gen.emit(s, POP_TOP);
         }
         return sym_stmt_t::gen_rvalue(gen);
     }
 
     int sym_stmt_var_t::set_parent(sym_t::ref node) {
         for (const auto &s : vars) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_stmt_t::set_parent(node);
     }
@@ -1072,7 +1267,7 @@ namespace clib {
     }
 
     int sym_stmt_exp_t::set_parent(sym_t::ref node) {
-        seq->set_parent(shared_from_this());
+        seq->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1098,7 +1293,7 @@ namespace clib {
 
     int sym_stmt_return_t::set_parent(sym_t::ref node) {
         if (seq)
-            seq->set_parent(shared_from_this());
+            seq->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1123,7 +1318,7 @@ namespace clib {
 
     int sym_stmt_throw_t::set_parent(sym_t::ref node) {
         if (seq)
-            seq->set_parent(shared_from_this());
+            seq->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1146,7 +1341,7 @@ namespace clib {
 
     int sym_stmt_control_t::set_parent(sym_t::ref node) {
         if (label)
-            label->set_parent(shared_from_this());
+            label->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1178,10 +1373,10 @@ namespace clib {
     }
 
     int sym_stmt_if_t::set_parent(sym_t::ref node) {
-        seq->set_parent(shared_from_this());
-        true_stmt->set_parent(shared_from_this());
+        seq->set_parent(this);
+        true_stmt->set_parent(this);
         if (false_stmt)
-            false_stmt->set_parent(shared_from_this());
+            false_stmt->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1214,8 +1409,8 @@ namespace clib {
     }
 
     int sym_stmt_while_t::set_parent(sym_t::ref node) {
-        seq->set_parent(shared_from_this());
-        stmt->set_parent(shared_from_this());
+        seq->set_parent(this);
+        stmt->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1233,7 +1428,7 @@ namespace clib {
         gen.enter(sp_for);
         if (exp) {
             exp->gen_rvalue(gen);
-            gen.emit(exp.get(), POP_TOP);
+            gen.emit(exp, POP_TOP);
         } else if (vars)
             vars->gen_rvalue(gen);
         auto L1 = 0;
@@ -1241,13 +1436,13 @@ namespace clib {
         if (cond) {
             cond->gen_rvalue(gen);
             L1 = gen.code_length();
-            gen.emit(cond.get(), POP_JUMP_IF_FALSE, 0); // exit
+            gen.emit(cond, POP_JUMP_IF_FALSE, 0); // exit
         }
         body->gen_rvalue(gen);
         auto L3 = gen.code_length(); // iter
         if (iter) {
             iter->gen_rvalue(gen);
-            gen.emit(iter.get(), POP_TOP);
+            gen.emit(iter, POP_TOP);
         }
         gen.emit(nullptr, JUMP_ABSOLUTE, L2);
         if (cond)
@@ -1269,14 +1464,14 @@ namespace clib {
 
     int sym_stmt_for_t::set_parent(sym_t::ref node) {
         if (exp)
-            exp->set_parent(shared_from_this());
+            exp->set_parent(this);
         else if (vars)
-            vars->set_parent(shared_from_this());
+            vars->set_parent(this);
         if (cond)
-            cond->set_parent(shared_from_this());
+            cond->set_parent(this);
         if (iter)
-            iter->set_parent(shared_from_this());
-        body->set_parent(shared_from_this());
+            iter->set_parent(this);
+        body->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1293,9 +1488,9 @@ namespace clib {
     int sym_stmt_for_in_t::gen_rvalue(ijsgen &gen) {
         gen.enter(sp_for_each);
         iter->gen_rvalue(gen);
-        gen.emit(iter.get(), GET_ITER);
+        gen.emit(iter, GET_ITER);
         auto idx_exit = gen.code_length();
-        gen.emit(iter.get(), FOR_ITER, 0);
+        gen.emit(iter, FOR_ITER, 0);
         if (exp)
             exp->gen_lvalue(gen);
         else
@@ -1321,11 +1516,11 @@ namespace clib {
 
     int sym_stmt_for_in_t::set_parent(sym_t::ref node) {
         if (exp)
-            exp->set_parent(shared_from_this());
+            exp->set_parent(this);
         else
-            vars->set_parent(shared_from_this());
-        iter->set_parent(shared_from_this());
-        body->set_parent(shared_from_this());
+            vars->set_parent(this);
+        iter->set_parent(this);
+        body->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1359,9 +1554,9 @@ namespace clib {
 
     int sym_case_t::set_parent(sym_t::ref node) {
         if (exp)
-            exp->set_parent(shared_from_this());
+            exp->set_parent(this);
         for (const auto &s : stmts) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -1400,7 +1595,7 @@ namespace clib {
 
     int sym_stmt_switch_t::set_parent(sym_t::ref node) {
         for (const auto &s : cases) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_stmt_t::set_parent(node);
     }
@@ -1417,12 +1612,14 @@ namespace clib {
 
     int sym_stmt_try_t::gen_rvalue(ijsgen &gen) {
         auto L1 = gen.code_length();
-        gen.emit(finally_body.get(), SETUP_FINALLY, 0, 0); // finally
+        gen.emit(finally_body, SETUP_FINALLY, 0, 0); // finally
         // TRY
         gen.enter(sp_try, finally_body);
         try_body->gen_rvalue(gen);
         gen.leave();
-        gen.emit(nullptr, POP_FINALLY);
+        auto L2 = gen.code_length();
+        gen.emit(nullptr, POP_FINALLY, 0);
+        auto L3 = -1;
         if (catch_body) {
             gen.edit(L1, 1, gen.code_length() - L1);
             gen.enter(sp_catch, finally_body);
@@ -1434,24 +1631,29 @@ namespace clib {
             // CATCH
             catch_body->gen_rvalue(gen);
             gen.leave();
-            gen.emit(nullptr, POP_FINALLY);
+            L3 = gen.code_length();
+            gen.emit(nullptr, POP_FINALLY, 0);
         }
+        gen.edit(L2, 1, gen.code_length() - L2);
+        if (L3 != -1)
+            gen.edit(L3, 1, gen.code_length() - L3);
         // FINALLY
         if (finally_body) {
             gen.edit(L1, 2, gen.code_length() - L1);
             finally_body->gen_rvalue(gen);
+            gen.emit(nullptr, END_FINALLY);
         }
         return sym_stmt_t::gen_rvalue(gen);
     }
 
     int sym_stmt_try_t::set_parent(sym_t::ref node) {
-        try_body->set_parent(shared_from_this());
+        try_body->set_parent(this);
         if (var)
-            var->set_parent(shared_from_this());
+            var->set_parent(this);
         if (catch_body)
-            catch_body->set_parent(shared_from_this());
+            catch_body->set_parent(this);
         if (finally_body)
-            finally_body->set_parent(shared_from_this());
+            finally_body->set_parent(this);
         return sym_stmt_t::set_parent(node);
     }
 
@@ -1472,7 +1674,7 @@ namespace clib {
         decltype(stmts) others;
         for (const auto &s : stmts) {
             if (s->get_type() == s_statement_exp) {
-                auto exp = std::dynamic_pointer_cast<sym_stmt_exp_t>(s);
+                auto exp = dynamic_cast<sym_stmt_exp_t *>(s);
                 const auto c = exp->seq->exps;
                 if (c.size() == 1) {
                     if (c.front()->get_type() == s_code) {
@@ -1492,7 +1694,7 @@ namespace clib {
             s->gen_rvalue(gen);
         }
         for (const auto &s : var_decls) {
-            std::dynamic_pointer_cast<sym_id_t>(s)->gen_rvalue_decl(gen);
+            dynamic_cast<sym_id_t *>(s)->gen_rvalue_decl(gen);
         }
         for (const auto &s : others) {
             s->gen_rvalue(gen);
@@ -1503,7 +1705,7 @@ namespace clib {
 
     int sym_block_t::set_parent(sym_t::ref node) {
         for (const auto &s : stmts) {
-            s->set_parent(shared_from_this());
+            s->set_parent(this);
         }
         return sym_t::set_parent(node);
     }
@@ -1521,56 +1723,56 @@ namespace clib {
     int sym_code_t::gen_rvalue(ijsgen &gen) {
         fullName = gen.get_fullname(name ? name->data._identifier : LAMBDA_ID);
         simpleName = name ? name->data._identifier : LAMBDA_ID;
-        auto p = parent.lock();
+        debugFile = gen.get_filename();
+        debugLabel.clear();
+        auto p = parent;
+        const ast_node_index *pos = this;
         if (p) {
             if (p->get_type() == s_id) {
-                auto _id = std::dynamic_pointer_cast<sym_id_t>(p);
+                auto _id = dynamic_cast<sym_id_t *>(p);
                 if (!_id->ids.empty()) {
-                    std::stringstream ss2;
-                    auto idx = _id->ids.back().get();
-                    ss2 << "(" << gen.get_filename() << ":" << idx->line << ":" << idx->column
-                        << ") " << gen.get_code_text(idx);
-                    debugName = ss2.str();
+                    auto idx = _id->ids.back();
+                    pos = idx;
+                    debugLabel = gen.get_code_text(idx);
                 }
             } else if (p->get_type() == s_binop) {
                 do {
-                    auto _binop = std::dynamic_pointer_cast<sym_binop_t>(p);
+                    auto _binop = dynamic_cast<sym_binop_t *>(p);
                     if (_binop->op->flag == a_operator && _binop->op->data._op == T_ASSIGN) {
                         if (_binop->exp1->get_type() == s_member_dot) {
-                            auto _dot = std::dynamic_pointer_cast<sym_member_dot_t>(_binop->exp1);
-                            if (gen.get_code_text(_dot->exp.get()) == "this" && _dot->dots.size() == 1) {
-                                std::stringstream ss2;
-                                auto idx = _dot->exp.get();
-                                ss2 << "(" << gen.get_filename() << ":" << idx->line << ":" << idx->column
-                                    << ") " << gen.get_func_name() << ".prototype." << gen.get_code_text(_dot->dots.front());
-                                debugName = ss2.str();
+                            auto _dot = dynamic_cast<sym_member_dot_t *>(_binop->exp1);
+                            if (gen.get_code_text(_dot->exp) == "this" && _dot->dots.size() == 1) {
+                                pos = _dot->exp;
+                                debugLabel = gen.get_func_name() + ".prototype." + gen.get_code_text(_dot->dots.front());
                                 break;
                             }
                         }
-                        std::stringstream ss3;
-                        auto idx = _binop->exp1.get();
-                        ss3 << "(" << gen.get_filename() << ":" << idx->line << ":" << idx->column
-                            << ") " << fullName << " " << gen.get_code_text(idx);
-                        debugName = ss3.str();
+                        auto idx = _binop->exp1;
+                        pos = idx;
+                        debugLabel = fullName + " " + gen.get_code_text(idx);
                     }
                 } while (false);
             }
         }
-        if (debugName.empty()) {
+        if (debugLabel.empty()) {
+            pos = this;
+            debugLabel = fullName;
+        }
+        {
             std::stringstream ss;
-            ss << "(" << gen.get_filename() << ":" << this->line << ":" << this->column
-               << ") " << fullName;
+            ss << "(" << debugFile << ":" << pos->line << ":" << pos->column
+               << ") " << debugLabel;
             debugName = ss.str();
         }
         if (name)
-            gen.add_var(simpleName, shared_from_this());
+            gen.add_var(simpleName, this);
         if (!args.empty())
             gen.enter(sp_param);
-        auto id = gen.push_function(std::dynamic_pointer_cast<sym_code_t>(shared_from_this()));
+        auto id = gen.push_function(shared_from_this());
         if (body) {
             if (!arrow && name) {
                 gen.enter(sp_block);
-                gen.add_var(simpleName, shared_from_this());
+                gen.add_var(simpleName, this);
             }
             body->gen_rvalue(gen);
             if (body->get_base_type() == s_expression)
@@ -1587,8 +1789,8 @@ namespace clib {
         uint32_t flag = 0;
         if (!closure.empty()) {
             for (const auto &s : closure) {
-                gen.emit(s->node, LOAD_CLOSURE, gen.load_string(
-                        s->node->data._identifier, cjs_consts::get_string_t::gs_name));
+                gen.emit(s, LOAD_CLOSURE, gen.load_string(
+                        s->data._identifier, cjs_consts::get_string_t::gs_name));
             }
             flag |= 8U;
             gen.emit(nullptr, BUILD_MAP, closure.size());
@@ -1597,7 +1799,7 @@ namespace clib {
             gen.emit(name, LOAD_CONST, id);
             gen.emit(name, LOAD_CONST, gen.load_string(debugName, cjs_consts::get_string_t::gs_string));
             gen.emit(this, MAKE_FUNCTION, (int) flag);
-            if (parent.lock()->get_type() == s_statement_exp)
+            if (parent->get_type() == s_statement_exp)
                 gen.emit(name, STORE_NAME, gen.load_string(name->data._identifier, cjs_consts::get_string_t::gs_name));
         } else {
             gen.emit(nullptr, LOAD_CONST, id);
@@ -1607,12 +1809,17 @@ namespace clib {
         if (!args.empty())
             gen.leave();
         consts.save();
+        // 函数已生成，释放函数体的符号节点
+        body = nullptr;
+        args.clear();
+        closure.clear();
+        syms = nullptr;
         return sym_t::gen_rvalue(gen);
     }
 
     int sym_code_t::set_parent(sym_t::ref node) {
         if (body)
-            body->set_parent(shared_from_this());
+            body->set_parent(this);
         return sym_t::set_parent(node);
     }
 }
\ No newline at end of file
@@ -3,20 +3,162 @@
 // Created by bajdcc
 //
 
+#include <array>
 #include <tuple>
 #include <cmath>
 #include <sstream>
 #include <codecvt>
 #include <locale>
 #include <cassert>
+#include <cstring>
+#include <climits>
 #include "cjslexer.h"
 
+#define LEXER_WINDOW 1024
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEXER_SSE2 1
+#else
+#define LEXER_SSE2 0
+#endif
+
+#if LEXER_SSE2 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace clib {
 
     using namespace types;
 
+    enum char_class_t {
+        cc_id_start = 1U << 0U,
+        cc_id_part = 1U << 1U,
+        cc_digit = 1U << 2U,
+        cc_space = 1U << 3U,
+    };
+
+    struct char_class_table {
+        std::array<uint8_t, 256> c{};
+
+        char_class_table() {
+            for (auto i = 0; i < 256; i++) {
+                auto ch = (char) i;
+                if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_' || ch == '$')
+                    c[i] |= cc_id_start | cc_id_part;
+                if (ch >= '0' && ch <= '9')
+                    c[i] |= cc_digit | cc_id_part;
+                if (ch == ' ' || (ch >= '\t' && ch <= '\r'))
+                    c[i] |= cc_space;
+            }
+        }
+    };
+
+    static const char_class_table char_class;
+
+#define IS_ID_START(ch) (char_class.c[(uint8_t) (ch)] & cc_id_start)
+#define IS_ID_PART(ch) (char_class.c[(uint8_t) (ch)] & cc_id_part)
+#define IS_DIGIT(ch) (char_class.c[(uint8_t) (ch)] & cc_digit)
+#define IS_SPACE(ch) (char_class.c[(uint8_t) (ch)] & cc_space)
+
+#if LEXER_SSE2
+    static inline int lowest_bit(unsigned int m) {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward(&i, m);
+        return (int) i;
+#else
+        return __builtin_ctz(m);
+#endif
+    }
+
+    static inline int count_bits(unsigned int m) {
+#ifdef _MSC_VER
+        return (int) __popcnt(m);
+#else
+        return __builtin_popcount(m);
+#endif
+    }
+
+    static inline unsigned int match16(const char *s, char c) {
+        auto v = _mm_loadu_si128((const __m128i *) s);
+        return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+    }
+
+    static inline unsigned int match16(const char *s, char c1, char c2) {
+        auto v = _mm_loadu_si128((const __m128i *) s);
+        return (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(c1)),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8(c2))));
+    }
+#endif
+
+    // 跳过连续的空格或Tab
+    static int skip_blank(const char *s, int j, int len) {
+#if LEXER_SSE2
+        for (; j + 16 <= len; j += 16) {
+            auto m = match16(s + j, ' ', '\t') ^ 0xFFFFU;
+            if (m)
+                return j + lowest_bit(m);
+        }
+#endif
+        for (; j < len && (s[j] == ' ' || s[j] == '\t'); j++);
+        return j;
+    }
+
+    // 查找第一个换行符
+    static int find_eol(const char *s, int j, int len) {
+#if LEXER_SSE2
+        for (; j + 16 <= len; j += 16) {
+            auto m = match16(s + j, '\n', '\r');
+            if (m)
+                return j + lowest_bit(m);
+        }
+#endif
+        for (; j < len && s[j] != '\n' && s[j] != '\r'; j++);
+        return j;
+    }
+
+    // 查找字符串结束符或转义符
+    static int find_quote(const char *s, int j, int len, char q) {
+#if LEXER_SSE2
+        for (; j + 16 <= len; j += 16) {
+            auto m = match16(s + j, q, '\\');
+            if (m)
+                return j + lowest_bit(m);
+        }
+#endif
+        for (; j < len && s[j] != q && s[j] != '\\'; j++);
+        return j;
+    }
+
+    // 查找 '*/'，返回 '/' 的位置，同时统计换行数
+    static int find_comment_end(const char *s, int j, int len, int &newline) {
+#if LEXER_SSE2
+        for (; j + 16 <= len; j += 16) {
+            auto m = match16(s + j, '/');
+            while (m) {
+                auto k = j + lowest_bit(m);
+                if (s[k - 1] == '*') {
+                    newline += count_bits(match16(s + j, '\n') & ((1U << (unsigned int) (k - j)) - 1U));
+                    return k;
+                }
+                m &= m - 1;
+            }
+            newline += count_bits(match16(s + j, '\n'));
+        }
+#endif
+        for (; j < len; j++) {
+            if (s[j] == '/' && s[j - 1] == '*')
+                return j;
+            if (s[j] == '\n')
+                newline++;
+        }
+        return len;
+    }
+
     cjslexer::cjslexer() {
-        std::array<std::tuple<lexer_t, std::string>, KEYWORD_END - KEYWORD_START + 1> keyword_string_list = {
+        std::array<std::tuple<lexer_t, const char *>, KEYWORD_END - KEYWORD_START - 2> keyword_string_list = {
                 std::make_tuple(K_NEW, "new"),
                 std::make_tuple(K_VAR, "var"),
                 std::make_tuple(K_LET, "let"),
@@ -50,13 +192,34 @@ namespace clib {
                 std::make_tuple(K_FINALLY, "finally"),
                 std::make_tuple(K_DEBUGGER, "debugger"),
         };
-        auto key_N = KEYWORD_END - KEYWORD_START - 1;
-        for (auto i = 0; i < key_N; i++) {
-            const auto &k = keyword_string_list[i];
-            mapKeyword.insert({std::string(std::get<1>(k)), std::get<0>(k)});
+        for (const auto &k : keyword_string_list) {
+            auto str = std::get<1>(k);
+            auto len = (int) strlen(str);
+            auto &kw = keywords[keyword_hash(str, len)];
+            assert(kw.t == NONE); // 完美哈希，不允许冲突
+            kw.t = std::get<0>(k);
+            kw.str = str;
+            kw.len = len;
         }
     }
 
+    char cjslexer::peek(int i) const {
+        return i < length ? text[i] : '\0';
+    }
+
+    int cjslexer::keyword_hash(const char *s, int len) {
+        return ((uint8_t) s[0] * 3 + (uint8_t) s[1] * 39 + len * 2) & 63;
+    }
+
+    lexer_t cjslexer::find_keyword(const char *s, int len) const {
+        if (len < 2 || len > 10)
+            return NONE;
+        const auto &kw = keywords[keyword_hash(s, len)];
+        if (kw.len == len && memcmp(kw.str, s, (size_t) len) == 0)
+            return kw.t;
+        return NONE;
+    }
+
     // 十六进制字符转十进制
     static int hex2dec(char c) {
         if (c >= '0' && c <= '9') {
@@ -120,55 +283,112 @@ namespace clib {
         }
     }
 
-    void cjslexer::input(const std::string &s, std::string &error_string) {
-        decltype(units) us;
+    void cjslexer::input(const char *s, size_t size, std::string &error_string) {
+        reset(s, size);
+        fill(INT_MAX);
+        error_string = error;
+    }
+
+    void cjslexer::reset(const char *s, size_t size) {
         text = s;
-        auto len = (int) text.length();
-        text.push_back(0);
-        text.push_back(0);
-        text.push_back(0); // 防止溢出
-        auto i = 0;
-        auto line = 1;
-        auto column = 1;
+        length = (int) size;
+        pos = 0;
+        line = 1;
+        column = 1;
+        newline = false;
+        finished = false;
+        error.clear();
+        index = 0;
+        base = 0;
+        units.clear();
+        data.clear();
+        data_base = 0;
+    }
+
+    bool cjslexer::has_data(const lexer_unit &u) {
+        return u.t == ID || u.t == NUMBER || u.t == STRING || u.t == REGEX;
+    }
+
+    void cjslexer::slice(const cjslexer &from, int begin, int end) {
+        assert(from.finished && from.base == 0);
+        reset(from.text, (size_t) from.length);
+        finished = true;
+        error.clear();
+        index = base = begin;
+        units.assign(from.units.begin() + begin, from.units.begin() + end);
+        auto u = from.units[end];
+        u.t = END;
+        u.end = u.start;
+        u.id = end;
+        units.push_back(u);
+        // 只复制本段用到的常量
+        auto lo = from.data_base + (int) from.data.size();
+        auto hi = lo;
+        for (auto i = begin; i < end; i++) {
+            if (has_data(from.units[i])) {
+                lo = from.units[i].idx;
+                break;
+            }
+        }
+        for (auto i = end; i < (int) from.units.size(); i++) {
+            if (has_data(from.units[i])) {
+                hi = from.units[i].idx;
+                break;
+            }
+        }
+        data_base = lo;
+        data.assign(from.data.begin() + (lo - from.data_base), from.data.begin() + (hi - from.data_base));
+    }
+
+    void cjslexer::fill(int idx) {
+        if (finished)
+            return;
+        auto len = length;
+        auto i = pos;
+        auto emit = [&](lexer_unit &u) {
+            u.id = base + (int) units.size();
+            u.newline = newline;
+            newline = false;
+            units.push_back(u);
+        };
 #if 0
         auto ii = 0;
         auto iL = 0;
         auto iC = 0;
 #endif
         std::vector<char> buf(256);
-        for (i = 0; i < len;) {
-            auto c = text[i];
+        while (i < len && base + (int) units.size() <= idx) {
+            auto c = peek(i);
 #if 0
             if (ii > 0)
                 fprintf(stdout, "P [%04d-%04d] Line: %04d, Column: %03d '%s'\n", ii, i, iL, iC,
-                        text.substr((size_t) ii, (size_t) (i - ii)).c_str());
+                        std::string(text + (size_t) ii, (size_t) (i - ii)).c_str());
             ii = i;
             iL = line;
             iC = column;
 #endif
-            if (isalpha(c) || c == '_' || c == '$') { // 变量名或关键字
+            if (IS_ID_START(c)) { // 变量名或关键字
                 auto j = 0;
-                for (j = i + 1; isalnum(text[j]) || text[j] == '_' || text[j] == '$'; j++);
-                auto keyword = text.substr((size_t) i, (size_t) (j - i));
-                auto kw = mapKeyword.find(keyword);
+                for (j = i + 1; IS_ID_PART(peek(j)); j++);
+                auto kw = find_keyword(text + i, j - i);
                 auto u = alloc_unit(line, column, i, j);
-                if (kw != mapKeyword.end()) { // 哈希查找关键字
-                    u.t = kw->second;
+                if (kw != NONE) { // 哈希查找关键字
+                    u.t = kw;
                 } else { // 变量名
                     u.t = ID;
                     u.len = j - i;
                     u.idx = alloc(u.len + 1);
-                    std::copy(text.begin() + i, text.begin() + j, data.begin() + u.idx);
-                    data[u.idx + u.len] = 0;
+                    std::copy(text + i, text + j, data_at(u.idx));
+                    data_at(u.idx)[u.len] = 0;
                 }
-                us.push_back(u);
+                emit(u);
                 column += j - i;
                 i = j;
                 continue;
-            } else if (isdigit(c) || (c == '.' && isdigit(text[i + 1])) ||
-                       (c == '-' && (isdigit(text[i + 1]) || text[i + 1] == '.'))) { // 数字
+            } else if (IS_DIGIT(c) || (c == '.' && IS_DIGIT(peek(i + 1))) ||
+                       (c == '-' && (IS_DIGIT(peek(i + 1)) || peek(i + 1) == '.'))) { // 数字
                 // 判断是否可以负数
-                if (c != '-' || allow_expr(us)) {
+                if (c != '-' || allow_expr(units)) {
                     // 假定这里的数字规则是以0-9开头
                     // 正则：^((?:\d+(\.)?\d*)(?:[eE][+-]?\d+)?)$
                     // 正则：^0[Xx][0-9A-Fa-f]+$
@@ -176,11 +396,11 @@ namespace clib {
                     // 注意：这里不考虑负数，因为估计到歧义（可能是减法呢？）
                     bool neg = false;
                     auto d = 0.0;
-                    auto c1 = text[i + 1];
+                    auto c1 = peek(i + 1);
                     auto j = i;
                     if (c == '-') {
                         c = c1;
-                        c1 = text[i + 2];
+                        c1 = peek(i + 2);
                         j++;
                         neg = true;
                     }
@@ -188,71 +408,71 @@ namespace clib {
                         if (c1 == 'x' || c1 == 'X') {
                             auto cc = 0;
                             // 十六进制
-                            for (j = i + 2; (cc = hex2dec(text[j])) != -1; j++) {
+                            for (j = i + 2; (cc = hex2dec(peek(j))) != -1; j++) {
                                 d *= 16.0;
                                 d += cc;
                             }
                             if (j == i + 2) {
                                 snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid number '%.2s'", line, column,
-                                         &text[i]);
+                                         text + i);
                                 break;
                             }
                             auto u = alloc_unit(line, column, i, j);
                             u.t = NUMBER;
                             u.len = sizeof(d);
                             u.idx = alloc(u.len);
-                            *((double *) &data[u.idx]) = d;
-                            us.push_back(u);
+                            *((double *) data_at(u.idx)) = d;
+                            emit(u);
                             column += j - i;
                             i = j;
                             continue;
                         } else if (c1 == 'b' || c1 == 'B') {
                             auto cc = 0;
                             // 二进制
-                            for (j = i + 2; (cc = bin2dec(text[j])) != -1; j++) {
+                            for (j = i + 2; (cc = bin2dec(peek(j))) != -1; j++) {
                                 d *= 2;
                                 d += cc;
                             }
                             if (j == i + 2) {
                                 snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid number '%.2s'", line, column,
-                                         &text[i]);
+                                         text + i);
                                 break;
                             }
                             auto u = alloc_unit(line, column, i, j);
                             u.t = NUMBER;
                             u.len = sizeof(d);
                             u.idx = alloc(u.len);
-                            *((double *) &data[u.idx]) = d;
-                            us.push_back(u);
+                            *((double *) data_at(u.idx)) = d;
+                            emit(u);
                             column += j - i;
                             i = j;
                             continue;
                         } else {
                             j = i + 1;
                             if (c1 == 'o' || c1 == 'O') { // 八进制
-                                c1 = text[j];
+                                c1 = peek(j);
                                 j++;
                             }
                             if (c1 >= '0' && c1 <= '7') { // 八进制
                                 auto cc = 0;
                                 // 八进制
-                                for (; (cc = oct2dec(text[j])) != -1; j++) {
+                                for (; (cc = oct2dec(peek(j))) != -1; j++) {
                                     d *= 8.0;
                                     d += cc;
                                 }
-                                if (!(oct2dec(text[j]) && isdigit(text[j]))) {
+                                if (!(oct2dec(peek(j)) && IS_DIGIT(peek(j)))) {
                                     if (j == i + 2) {
                                         snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid number '%.2s'\n", line,
                                                  column,
-                                                 &text[i]);
+                                                 text + i);
                                         break;
                                     }
                                     auto u = alloc_unit(line, column, i, j);
                                     u.t = NUMBER;
                                     u.len = sizeof(d);
                                     u.idx = alloc(u.len);
-                                    *((double *) &data[u.idx]) = d;
-                                    us.push_back(u);
+                                    *((double *) data_at(u.idx)) = d;
+                                    emit(u);
                                     column += j - i;
                                     i = j;
                                     continue;
@@ -263,44 +483,44 @@ namespace clib {
                         }
                     }
                     // 判断整数部分
-                    for (; isdigit(text[j]); j++) { // 解析整数部分
+                    for (; IS_DIGIT(peek(j)); j++) { // 解析整数部分
                         d *= 10.0;
-                        d += text[j] - '0';
+                        d += peek(j) - '0';
                     }
-                    if (text[j] == '.') { // 解析小数部分
+                    if (peek(j) == '.') { // 解析小数部分
                         auto l = ++j;
-                        for (; isdigit(text[j]); j++) {
+                        for (; IS_DIGIT(peek(j)); j++) {
                             d *= 10.0;
-                            d += text[j] - '0';
+                            d += peek(j) - '0';
                         }
                         l = j - l;
                         if (l > 0) {
                             d *= pow(10.0, -l);
                         }
                     }
-                    if (text[j] == 'e' || text[j] == 'E') { // 科学计数法
+                    if (peek(j) == 'e' || peek(j) == 'E') { // 科学计数法
                         auto ne = false;
                         auto e = 0.0;
-                        if (!isdigit(text[++j])) {
-                            if (text[j] == '-') { // 1e-1
+                        if (!IS_DIGIT(peek(++j))) {
+                            if (peek(j) == '-') { // 1e-1
                                 ne = true;
                                 j++;
-                            } else if (text[j] == '+') {
+                            } else if (peek(j) == '+') {
                                 j++;
-                            } else if (!isdigit(text[j])) { // 1e+1
+                            } else if (!IS_DIGIT(peek(j))) { // 1e+1
                                 snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid number '%s'", line, column,
-                                         text.substr((size_t) i, (size_t) (j - i)).c_str());
+                                         std::string(text + (size_t) i, (size_t) (j - i)).c_str());
                                 break;
                             }
                         }
                         auto l = j;
-                        for (; isdigit(text[j]); j++) { // 解析指数部分
+                        for (; IS_DIGIT(peek(j)); j++) { // 解析指数部分
                             e *= 10;
-                            e += text[j] - '0';
+                            e += peek(j) - '0';
                         }
                         if (l == j) {
                             snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid number '%s'", line, column,
-                                     text.substr((size_t) i, (size_t) (j - i)).c_str());
+                                     std::string(text + (size_t) i, (size_t) (j - i)).c_str());
                             break;
                         }
                         d *= pow(10.0, ne ? -e : e);
@@ -309,20 +529,17 @@ namespace clib {
                     u.t = NUMBER;
                     u.len = sizeof(d);
                     u.idx = alloc(u.len);
-                    *((double *) &data[u.idx]) = neg ? -d : d;
-                    us.push_back(u);
+                    *((double *) data_at(u.idx)) = neg ? -d : d;
+                    emit(u);
                     column += j - i;
                     i = j;
                     continue;
                 }
-            } else if (isspace(c)) { // 空白字符
+            } else if (IS_SPACE(c)) { // 空白字符
                 auto j = 0;
                 if (c == ' ' || c == '\t') {
                     // 查找连续的空格或Tab
-                    for (j = i + 1; text[j] == ' ' || text[j] == '\t'; j++);
-                    auto u = alloc_unit(line, column, i, j);
-                    u.t = SPACE;
-                    us.push_back(u);
+                    j = skip_blank(text, i + 1, len);
                     column += j - i;
                     i = j;
                     continue;
@@ -330,24 +547,22 @@ namespace clib {
                     // 查找连续的'\n'或'\r\n'
                     auto l = 0;
                     for (j = i; j < len;) {
-                        if (text[j] == '\r') {
-                            if (text[j + 1] == '\n') {
+                        if (peek(j) == '\r') {
+                            if (peek(j + 1) == '\n') {
                                 l++;
                                 j += 2;
                             } else {
                                 l++;
                                 j++;
                             }
-                        } else if (text[j] == '\n') {
+                        } else if (peek(j) == '\n') {
                             l++;
                             j++;
                         } else {
                             break;
                         }
                     }
-                    auto u = alloc_unit(line, column, i, j);
-                    u.t = NEWLINE;
-                    us.push_back(u);
+                    newline = true;
                     line += l;
                     column = 1;
                     i = j;
@@ -360,10 +575,13 @@ namespace clib {
                 auto j = i;
                 // 寻找非'\"'的第一个'"'
                 for (j++; j < len; j++) {
-                    if (text[j] == '\\') {
-                        if (text[j + 1] == '\\' || text[j + 1] == c) {
+                    j = find_quote(text, j, len, c);
+                    if (j == len)
+                        break;
+                    if (peek(j) == '\\') {
+                        if (peek(j + 1) == '\\' || peek(j + 1) == c) {
                             j++;
-                            if (text[j + 1] == c) {
+                            if (peek(j + 1) == c) {
                                 j++;
                                 break;
                             }
@@ -371,13 +589,26 @@ namespace clib {
                         }
                         continue;
                     }
-                    if (text[j] == c)break;
+                    if (peek(j) == c)break;
                 }
                 auto k = j;
                 if (k == len) { // " EOF
                     snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid string, missing %c", line, column, c);
                     break;
                 }
+                if (memchr(text + i + 1, '\\', (size_t) (k - i - 1)) == nullptr) { // 无转义，直接复制
+                    j = k + 1;
+                    auto u = alloc_unit(line, column, i, j);
+                    u.t = STRING;
+                    u.len = j - i;
+                    u.idx = alloc(u.len + 1);
+                    std::copy(text + i, text + j, data_at(u.idx));
+                    data_at(u.idx)[u.len] = 0;
+                    emit(u);
+                    column += j - i;
+                    i = j;
+                    continue;
+                }
                 std::stringstream ss;
                 ss << c;
                 auto status = 1; // 状态机
@@ -388,27 +619,27 @@ namespace clib {
                 for (j = i + 1; j <= k;) {
                     switch (status) {
                         case 1: { // 处理字符
-                            if (text[j] == '\\') {
+                            if (peek(j) == '\\') {
                                 status = 2;
                             } else { // '?'
-                                ss << text[j];
+                                ss << peek(j);
                             }
                             j++;
                         }
                             break;
                         case 2: { // 处理转义
-                            if (text[j] == 'x') {
+                            if (peek(j) == 'x') {
                                 status = 3;
                                 j++;
                                 count = 2;
                                 digit = 16;
-                            } else if (text[j] == 'u') {
+                            } else if (peek(j) == 'u') {
                                 status = 3;
                                 j++;
                                 count = 4;
                                 digit = 16;
                             } else {
-                                auto esc = escape(text[j]);
+                                auto esc = escape(peek(j));
                                 if (esc != -1) {
                                     if (esc >= 0 && esc < 8) { //八进制
                                         status = 3;
@@ -426,7 +657,7 @@ namespace clib {
                         }
                             break;
                         case 3: { // 处理 '\x??'，'\111' 或 '\u????' 前一位十六进制数字
-                            auto esc = digit == 16 ? hex2dec(text[j]) : oct2dec(text[j]);
+                            auto esc = digit == 16 ? hex2dec(peek(j)) : oct2dec(peek(j));
                             if (esc != -1) {
                                 cc = (uint32_t) esc;
                                 status = 4;
@@ -438,7 +669,7 @@ namespace clib {
                         }
                             break;
                         case 4: { // 处理 '\x??'，'\111' 或 '\u????' 后面的十六进制数字
-                            auto esc = digit == 16 ? hex2dec(text[j]) : oct2dec(text[j]);
+                            auto esc = digit == 16 ? hex2dec(peek(j)) : oct2dec(peek(j));
                             auto fin = false;
                             if (esc != -1) {
                                 if (digit == 16) {
@@ -483,7 +714,7 @@ namespace clib {
                                         snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: '%s' during conversion '%s'\n",
                                                  line,
                                                  column,
-                                                 e.what(), text.substr((size_t) i, (size_t) (j - i)).c_str());
+                                                 e.what(), std::string(text + (size_t) i, (size_t) (j - i)).c_str());
                                         err = true;
                                     }
                                 }
@@ -492,7 +723,7 @@ namespace clib {
                             break;
                         default: // 失败
                             snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid string '%s'", line, column,
-                                     text.substr((size_t) i, (size_t) (j - i)).c_str());
+                                     std::string(text + (size_t) i, (size_t) (j - i)).c_str());
                             err = true;
                             break;
                     }
@@ -506,9 +737,9 @@ namespace clib {
                     u.t = STRING;
                     u.len = (int) st.length();
                     u.idx = alloc(u.len + 1);
-                    std::copy(st.begin(), st.end(), data.begin() + u.idx);
-                    data[u.idx + u.len] = 0;
-                    us.push_back(u);
+                    std::copy(st.begin(), st.end(), data_at(u.idx));
+                    data_at(u.idx)[u.len] = 0;
+                    emit(u);
                     column += j - i;
                     i = j;
                     continue;
@@ -517,72 +748,61 @@ namespace clib {
                     break;
                 }
             } else if (c == '/') { // 注释
-                auto c1 = text[i + 1];
+                auto c1 = peek(i + 1);
                 if (c1 == '/' || c1 == '*') { // 注释
                     auto j = i + 1;
                     if (c1 == '/') { // '//'
                         // 寻找第一个换行符
-                        for (++j; text[j] != '\n' && text[j] != '\r'; j++);
-                        auto u = alloc_unit(line, column, i, j);
-                        u.t = COMMENT;
-                        us.push_back(u);
+                        j = find_eol(text, j + 1, len);
                         column += j - i;
                         i = j;
                     } else { // '/*  */'
                         // 寻找第一个 '*/'
-                        char prev = 0;
-                        auto col = column;
-                        auto newline = 0;
-                        for (++j;;) {
-                            if (prev == '*' && text[j] == '/')
-                                break;
-                            prev = text[j++];
-                            if (prev == '\n') {
-                                ++newline;
-                                col = 1;
-                            } else {
-                                col++;
-                            }
+                        auto nl = peek(i + 2) == '\n' ? 1 : 0;
+                        j = find_comment_end(text, i + 3, len, nl);
+                        if (j >= len) {
+                            snprintf(buf.data(), buf.size(), "Line: %d, Column: %d, Error: invalid comment, missing */", line, column);
+                            break;
                         }
                         j++;
-                        auto u = alloc_unit(line, column, i, j);
-                        u.t = COMMENT;
-                        us.push_back(u);
                         column += j - i;
-                        line += newline;
+                        line += nl;
+                        if (nl > 0)
+                            newline = true;
                         i = j;
                     }
                     continue;
                 } else {
                     // 判断正则表达式？
                     // 寻找满足的条件，如四则、return之后
-                    if (allow_expr(us)) {
+                    if (allow_expr(units)) {
                         auto j = i;
                         auto squ = false;
                         for (++j; j < len; j++) {
-                            if (text[j] == '\\') {
+                            if (peek(j) == '\\') {
                                 j++;
                                 continue;
                             }
-                            if (text[j] == '/' && !squ)break;
-                            if (text[j] == '[') squ = true;
-                            else if (text[j] == ']') squ = false;
+                            if (peek(j) == '/' && !squ)break;
+                            if (peek(j) == '[') squ = true;
+                            else if (peek(j) == ']') squ = false;
                         }
-                        j++;
+                        if (j < len)
+                            j++;
                         // postfix: /i /g /gi /ig /m
                         for (auto k = 0; k < 3; k++) {
-                            if (text[j] == 'g' || text[j] == 'i' || text[j] == 'm') {
+                            if (peek(j) == 'g' || peek(j) == 'i' || peek(j) == 'm') {
                                 j++;
                             }
                         }
                         auto u = alloc_unit(line, column, i, j);
                         u.t = REGEX;
-                        auto re = text.substr((size_t) i, (size_t) (j - i));
+                        std::string re(text + i, (size_t) (j - i));
                         u.len = (int) re.length();
                         u.idx = alloc(u.len + 1);
-                        std::copy(re.begin(), re.end(), data.begin() + u.idx);
-                        data[u.idx + u.len] = 0;
-                        us.push_back(u);
+                        std::copy(re.begin(), re.end(), data_at(u.idx));
+                        data_at(u.idx)[u.len] = 0;
+                        emit(u);
                         column += j - i;
                         i = j;
                         continue;
@@ -592,8 +812,8 @@ namespace clib {
             {
                 auto T = NONE;
                 auto j = i;
-                auto c1 = text[i + 1];
-                auto c2 = text[i + 2];
+                auto c1 = peek(i + 1);
+                auto c2 = peek(i + 2);
                 switch (c) {
                     case '=':
                         if (c1 == '=') {
@@ -615,7 +835,7 @@ namespace clib {
                     case '>':
                         if (c1 == '>') {
                             if (c2 == '>') {
-                                auto c3 = text[i + 3];
+                                auto c3 = peek(i + 3);
                                 if (c3 == '=') {
                                     T = T_ASSIGN_URSHIFT;
                                     j += 4;
@@ -843,7 +1063,7 @@ namespace clib {
                 if (T != NONE) {
                     auto u = alloc_unit(line, column, i, j);
                     u.t = T;
-                    us.push_back(u);
+                    emit(u);
                     column += j - i;
                     i = j;
                     continue;
@@ -853,108 +1073,109 @@ namespace clib {
                 }
             }
         }
-        {
-            std::string _error_string = buf.data();
-            if (!_error_string.empty()) {
-                error_string = _error_string;
-                return;
-            }
-            auto id = 0;
-            auto no_l = true;
-            for (auto &U : us) {
-                switch (U.t) {
-                    case NEWLINE:
-                        no_l = false;
-                    case SPACE:
-                    case COMMENT:
-                        break;
-                    default:
-                        U.id = id++;
-                        units.push_back(U);
-                        no_line.push_back(no_l);
-                        if (!no_l)no_l = true;
-                        break;
-                }
+        pos = i;
+        if (buf[0]) {
+            error = buf.data();
+        } else if (i < len) {
+            return;
+        }
+        // 出错时也以END结束，由语法分析报告错误
+        finished = true;
+        auto u = alloc_unit(line, column, i, i);
+        u.t = END;
+        emit(u);
+    }
+
+    void cjslexer::trim() {
+        if (index - base <= LEXER_WINDOW * 2)
+            return;
+        while (index - base > LEXER_WINDOW) {
+            units.pop_front();
+            base++;
+        }
+        auto live = data_base + (int) data.size();
+        for (const auto &u : units) {
+            if (has_data(u)) {
+                live = u.idx;
+                break;
             }
-            auto u = alloc_unit(line, column, i, i);
-            u.t = END;
-            u.id = id;
-            units.push_back(u);
+        }
+        if (live - data_base > (int) data.size() / 2) {
+            data.erase(data.begin(), data.begin() + (live - data_base));
+            data_base = live;
         }
     }
 
 #define js_mem_align(d, a) (((d) + (a - 1)) & ~(a - 1))
 
     int cjslexer::alloc(int size) {
-        auto idx = (int) data.size();
+        auto idx = data_base + (int) data.size();
         data.resize(data.size() + js_mem_align(size, 4));
         return idx;
     }
 
+    char *cjslexer::data_at(int idx) {
+        return &data[idx - data_base];
+    }
+
 #undef js_mem_align
 
-    bool cjslexer::allow_expr(const std::vector<lexer_unit> &u) {
-        bool can = false;
-        for (auto U = u.rbegin(); U != u.rend(); U++) {
-            if (U->t == NEWLINE || U->t == COMMENT || U->t == SPACE)
-                continue;
-            switch (U->t) {
-                case K_RETURN:
-                case K_CASE:
-                case T_ADD:
-                case T_SUB:
-                case T_MUL:
-                case T_DIV:
-                case T_MOD:
-                case T_POWER:
-                case T_INC:
-                case T_DEC:
-                case T_ASSIGN:
-                case T_ASSIGN_ADD:
-                case T_ASSIGN_SUB:
-                case T_ASSIGN_MUL:
-                case T_ASSIGN_DIV:
-                case T_ASSIGN_MOD:
-                case T_ASSIGN_LSHIFT:
-                case T_ASSIGN_RSHIFT:
-                case T_ASSIGN_URSHIFT:
-                case T_ASSIGN_AND:
-                case T_ASSIGN_OR:
-                case T_ASSIGN_XOR:
-                case T_ASSIGN_POWER:
-                case T_LESS:
-                case T_LESS_EQUAL:
-                case T_GREATER:
-                case T_GREATER_EQUAL:
-                case T_EQUAL:
-                case T_FEQUAL:
-                case T_NOT_EQUAL:
-                case T_FNOT_EQUAL:
-                case T_LOG_NOT:
-                case T_LOG_AND:
-                case T_LOG_OR:
-                case T_BIT_NOT:
-                case T_BIT_AND:
-                case T_BIT_OR:
-                case T_BIT_XOR:
-                case T_COMMA:
-                case T_SEMI:
-                case T_COLON:
-                case T_QUERY:
-                case T_LSHIFT:
-                case T_RSHIFT:
-                case T_URSHIFT:
-                case T_LPARAN:
-                case T_LSQUARE:
-                case T_LBRACE:
-                    can = true;
-                    break;
-                default:
-                    break;
-            }
-            break;
+    bool cjslexer::allow_expr(const std::deque<lexer_unit> &u) {
+        if (u.empty())
+            return false;
+        switch (u.back().t) {
+            case K_RETURN:
+            case K_CASE:
+            case T_ADD:
+            case T_SUB:
+            case T_MUL:
+            case T_DIV:
+            case T_MOD:
+            case T_POWER:
+            case T_INC:
+            case T_DEC:
+            case T_ASSIGN:
+            case T_ASSIGN_ADD:
+            case T_ASSIGN_SUB:
+            case T_ASSIGN_MUL:
+            case T_ASSIGN_DIV:
+            case T_ASSIGN_MOD:
+            case T_ASSIGN_LSHIFT:
+            case T_ASSIGN_RSHIFT:
+            case T_ASSIGN_URSHIFT:
+            case T_ASSIGN_AND:
+            case T_ASSIGN_OR:
+            case T_ASSIGN_XOR:
+            case T_ASSIGN_POWER:
+            case T_LESS:
+            case T_LESS_EQUAL:
+            case T_GREATER:
+            case T_GREATER_EQUAL:
+            case T_EQUAL:
+            case T_FEQUAL:
+            case T_NOT_EQUAL:
+            case T_FNOT_EQUAL:
+            case T_LOG_NOT:
+            case T_LOG_AND:
+            case T_LOG_OR:
+            case T_BIT_NOT:
+            case T_BIT_AND:
+            case T_BIT_OR:
+            case T_BIT_XOR:
+            case T_COMMA:
+            case T_SEMI:
+            case T_COLON:
+            case T_QUERY:
+            case T_LSHIFT:
+            case T_RSHIFT:
+            case T_URSHIFT:
+            case T_LPARAN:
+            case T_LSQUARE:
+            case T_LBRACE:
+                return true;
+            default:
+                return false;
         }
-        return can;
     }
 
     lexer_unit cjslexer::alloc_unit(int line, int column, int start, int end) {
@@ -966,39 +1187,47 @@ namespace clib {
         return u;
     }
 
-    void cjslexer::dump() const {
-        for (size_t i = 0; i < units.size(); i++) {
-            fprintf(stdout, "%s\n", get_unit_desc((int) i).c_str());
+    void cjslexer::dump() {
+        fill(INT_MAX);
+        for (auto i = base; i < base + (int) units.size(); i++) {
+            fprintf(stdout, "%s\n", get_unit_desc(i).c_str());
         }
     }
 
-    const lexer_unit &cjslexer::get_unit(int idx) const {
-        if (idx < 0 || idx >= (int) units.size()) {
-            return units.back();
+    const lexer_unit &cjslexer::get_unit(int idx) {
+        static const lexer_unit none;
+        if (idx < base) {
+            return none;
         }
-        return units[idx];
+        if (idx >= base + (int) units.size()) {
+            fill(idx);
+            if (idx >= base + (int) units.size())
+                return units.back();
+        }
+        return units[idx - base];
     }
 
     const char *cjslexer::get_data(int idx) const {
-        if (idx < 0 || idx >= (int) data.size()) {
+        if (idx < data_base || idx >= data_base + (int) data.size()) {
             return nullptr;
         }
-        return &data[idx];
+        return &data[idx - data_base];
     }
 
-    bool cjslexer::valid_rule(int idx, lexer_t rule) const {
-        if (idx < 0 || idx >= (int) units.size()) {
+    bool cjslexer::valid_rule(int idx, lexer_t rule) {
+        if (idx < base) {
             return false;
         }
+        const auto &U = get_unit(idx);
         switch (rule) {
             case RULE_NO_LINE:
-                return no_line[idx];
+                return !U.newline;
             case RULE_LINE:
-                return !no_line[idx];
+                return U.newline;
             case RULE_RBRACE:
-                return units[idx].t == T_RBRACE;
+                return U.t == T_RBRACE;
             case RULE_EOF:
-                return idx + 1 == (int) units.size();
+                return U.t == END;
             default:
                 break;
         }
@@ -1007,10 +1236,10 @@ namespace clib {
     }
 
     int cjslexer::get_unit_size() const {
-        return std::max((int) (units.size()) - 1, 0);
+        return std::max(base + (int) (units.size()) - 1, 0);
     }
 
-    std::string cjslexer::get_unit_desc(int idx) const {
+    std::string cjslexer::get_unit_desc(int idx) {
         auto U = get_unit(idx);
         auto type = "";
         auto isprint = true;
@@ -1041,19 +1270,24 @@ namespace clib {
         char buf[256];
         snprintf(buf, sizeof(buf), "D [%04d-%04d] Line: %04d, Column: %03d |%-10s| %.20s",
                  U.start, U.end, U.line, U.column,
-                 type, isprint ? text.substr((size_t) U.start, (size_t) (U.end - U.start)).c_str() : "");
+                 type, isprint ? std::string(text + U.start, (size_t) (U.end - U.start)).c_str() : "");
         return buf;
     }
 
+    const std::string &cjslexer::get_error() const {
+        return error;
+    }
+
     int cjslexer::get_index() const {
         return index;
     }
 
     void cjslexer::inc_index() {
         index++;
+        trim();
     }
 
-    const lexer_unit &cjslexer::get_current_unit() const {
+    const lexer_unit &cjslexer::get_current_unit() {
         return get_unit(index);
     }
 }
\ No newline at end of file
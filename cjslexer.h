@@ -6,9 +6,10 @@
 #ifndef CLIBJS_CJSLEXER_H
 #define CLIBJS_CJSLEXER_H
 
+#include <array>
+#include <deque>
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include "cjstypes.h"
 
 namespace clib {
@@ -24,6 +25,7 @@ namespace clib {
         int start{0};
         int end{0};
         int id{0};
+        bool newline{false}; // 之前有换行
     };
 
     class cjslexer {
@@ -34,31 +36,54 @@ namespace clib {
         cjslexer(const cjslexer &) = delete;
         cjslexer &operator=(const cjslexer &) = delete;
 
-        void input(const std::string &text, std::string &);
-        void dump() const;
+        void input(const char *text, size_t len, std::string &);
+        void reset(const char *text, size_t len); // 按需分析，只保留当前位置之前的窗口
+        void slice(const cjslexer &from, int begin, int end); // 复制已分析好的[begin, end)单词
+        void dump();
 
-        const lexer_unit &get_unit(int idx) const;
+        const lexer_unit &get_unit(int idx);
         int get_unit_size() const;
-        std::string get_unit_desc(int idx) const;
+        std::string get_unit_desc(int idx);
         const char *get_data(int idx) const;
-        bool valid_rule(int idx, lexer_t rule) const;
+        const std::string &get_error() const;
+        bool valid_rule(int idx, lexer_t rule);
 
         int get_index() const;
         void inc_index();
-        const lexer_unit &get_current_unit() const;
+        const lexer_unit &get_current_unit();
 
     private:
-        static bool allow_expr(const std::vector<lexer_unit> &u);
+        void fill(int idx);
+        void trim();
+        char *data_at(int idx);
+        static bool has_data(const lexer_unit &u);
+        static bool allow_expr(const std::deque<lexer_unit> &u);
+        static int keyword_hash(const char *s, int len);
+        lexer_t find_keyword(const char *s, int len) const;
+        char peek(int i) const;
         int alloc(int size);
         static lexer_unit alloc_unit(int line, int column, int start, int end);
 
     private:
         int index{0};
-        std::string text;
+        const char *text{nullptr};
+        int length{0};
+        int pos{0};
+        int line{1};
+        int column{1};
+        bool newline{false};
+        bool finished{false};
+        std::string error;
+        int base{0};
+        std::deque<lexer_unit> units;
+        int data_base{0};
         std::vector<char> data;
-        std::vector<lexer_unit> units;
-        std::unordered_map<std::string, lexer_t> mapKeyword;
-        std::vector<bool> no_line;
+        struct keyword_t {
+            lexer_t t{NONE};
+            const char *str{nullptr};
+            int len{0};
+        };
+        std::array<keyword_t, 64> keywords;
     };
 }
 
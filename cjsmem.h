@@ -6,6 +6,7 @@
 #ifndef CLIBJS_CJSMEM_H
 #define CLIBJS_CJSMEM_H
 
+#include <cstddef>
 #include <vector>
 #include <unordered_map>
 #include <set>
@@ -9,6 +9,8 @@
 #include <cassert>
 #include <fstream>
 #include <algorithm>
+#include <climits>
+#include <thread>
 #include "cjsparser.h"
 #include "cjsast.h"
 
@@ -22,20 +24,27 @@
 #define DUMP_PDA_FILE "PDA.txt"
 #define DEBUG_AST 0
 #define CHECK_AST 0
+#define MEMO_PARSING 1
+#define PSTACK_COMPACT (1 << 16)
+#define PARALLEL_MIN_TOKENS 8192
 
 namespace clib {
 
-    ast_node *cjsparser::parse(const std::string &str, std::string &error_string, csemantic *s) {
+    ast_node *cjsparser::parse(const cjs_source &src, std::string &error_string, csemantic *s) {
         semantic = s;
-        lexer = std::make_unique<cjslexer>();
-        lexer->input(str, error_string);
-        if (!error_string.empty()) {
-            lexer.reset(nullptr);
-            return nullptr;
+        chunks.clear();
+        if (threads > 1) {
+            auto root = parse_parallel(src);
+            if (root)
+                return root;
         }
+        lexer = std::make_unique<cjslexer>();
 #if DUMP_LEXER
+        lexer->input(src.data(), src.length(), error_string);
         lexer->dump();
 #endif
+        // 词法分析随语法分析按需进行
+        lexer->reset(src.data(), src.length());
         ast = std::make_unique<cjsast>();
         current = nullptr;
         // 清空AST
@@ -44,20 +53,158 @@ namespace clib {
         if (unit.get_pda().empty())
             gen();
         // 语法分析（递归下降）
-        program();
+        if (!program()) {
+            // 所有分支都失败，报告回溯所到的最远单词
+            if (current->t == END)
+                error_string = error_message("unexpected end of input");
+            else
+                error_string = error_message("unexpected token " +
+                                             std::string(src.data() + current->start, current->end - current->start));
+            release();
+            return nullptr;
+        }
+        release();
         return ast->get_root();
     }
 
+    ast_node *cjsparser::parse_parallel(const cjs_source &src) {
+        auto full = std::make_unique<cjslexer>();
+        std::string error_string;
+        full->input(src.data(), src.length(), error_string);
+        if (!error_string.empty())
+            return nullptr;
+        auto size = full->get_unit_size();
+        auto n = std::min(threads, size / PARALLEL_MIN_TOKENS);
+        if (n < 2)
+            return nullptr;
+        // 预扫描：深度为0的分号之后可以切分，分号处语法分析会清空回溯，前后互不影响
+        // else和while可能属于前面的if和do，不在它们之前切分
+        std::vector<int> bounds{0};
+        auto depth = 0;
+        for (auto i = 0; i < size && (int) bounds.size() < n; i++) {
+            switch (full->get_unit(i).t) {
+                case T_LPARAN:
+                case T_LSQUARE:
+                case T_LBRACE:
+                    depth++;
+                    break;
+                case T_RPARAN:
+                case T_RSQUARE:
+                case T_RBRACE:
+                    depth--;
+                    break;
+                case T_SEMI: {
+                    if (depth != 0 || i + 1 < (int) ((long long) size * bounds.size() / n))
+                        break;
+                    auto next = full->get_unit(i + 1).t;
+                    if (next != END && next != K_ELSE && next != K_WHILE)
+                        bounds.push_back(i + 1);
+                }
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (bounds.size() < 2)
+            return nullptr;
+        bounds.push_back(size);
+        if (unit.get_pda().empty())
+            gen();
+        std::vector<cjsparser *> parts{this};
+        for (size_t i = 2; i < bounds.size(); i++) {
+            chunks.push_back(std::make_unique<cjsparser>());
+            auto &c = chunks.back();
+            c->grammar = grammar;
+            c->semantic = semantic;
+            parts.push_back(c.get());
+        }
+        std::vector<char> success(parts.size());
+        auto run = [&](size_t i) {
+            auto p = parts[i];
+            p->lexer = std::make_unique<cjslexer>();
+            p->lexer->slice(*full, bounds[i], bounds[i + 1]);
+            p->ast = std::make_unique<cjsast>();
+            p->ast->reset();
+            p->current = nullptr;
+            try {
+                success[i] = p->program();
+            } catch (const cexception &) {
+                success[i] = false;
+            }
+            p->release();
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < parts.size(); i++)
+            workers.emplace_back(run, i);
+        run(0);
+        for (auto &w : workers)
+            w.join();
+        // 任一段失败则回退到顺序分析，保证结果一致
+        if (std::find(success.begin(), success.end(), false) != success.end()) {
+            chunks.clear();
+            return nullptr;
+        }
+        // 把各段的语句接到第一段的SourceElements下
+        auto elements = [](cjsparser *p) -> ast_node * {
+            auto top = p->ast->get_root()->child;
+            if (!top || !top->child || top->child->next != top->child || top->child->flag != a_collection)
+                return nullptr;
+            return top->child;
+        };
+        auto to = elements(this);
+        for (const auto &c : chunks) {
+            auto from = elements(c.get());
+            if (!to || !from || from->data._coll != to->data._coll) {
+                chunks.clear();
+                return nullptr;
+            }
+        }
+        for (const auto &c : chunks) {
+            auto from = elements(c.get());
+            std::vector<ast_node *> children;
+            auto i = from->child;
+            do {
+                children.push_back(i);
+                i = i->next;
+            } while (i != from->child);
+            from->child = nullptr;
+            for (auto &child : children)
+                cjsast::set_child(to, child);
+        }
+        return ast->get_root();
+    }
+
+    // 分析结束后只保留AST，释放栈、缓存、记忆表和词法分析器
+    void cjsparser::release() {
+        current = nullptr;
+        lexer = nullptr;
+        state_stack = persistent_stack<int>();
+        ast_stack = persistent_stack<ast_node *>();
+        decltype(state_arena)().swap(state_arena);
+        decltype(ast_arena)().swap(ast_arena);
+        decltype(ast_cache)().swap(ast_cache);
+        decltype(ast_coll_cache)().swap(ast_coll_cache);
+        decltype(ast_reduce_cache)().swap(ast_reduce_cache);
+        decltype(memo_fail)().swap(memo_fail);
+    }
+
+    void cjsparser::set_threads(int n) {
+        threads = n > 0 ? n : (int) std::max(1U, std::thread::hardware_concurrency());
+    }
+
     ast_node *cjsparser::root() const {
         return ast->get_root();
     }
 
     void cjsparser::clear_ast() {
         ast.reset();
+        chunks.clear();
     }
 
     void cjsparser::next() {
         current = &lexer->get_current_unit();
+        if (current->t == END && !lexer->get_error().empty())
+            throw cexception(lexer->get_error());
         lexer->inc_index();
     }
 
@@ -532,19 +679,23 @@ namespace clib {
 #endif
     }
 
-    void cjsparser::program() {
+    bool cjsparser::program() {
 #if REPORT_ERROR
         std::ofstream log(REPORT_ERROR_FILE, std::ios::app | std::ios::out);
 #endif
         next();
-        state_stack.clear();
-        ast_stack.clear();
+        state_arena.clear();
+        ast_arena.clear();
+        state_stack = persistent_stack<int>(&state_arena);
+        ast_stack = persistent_stack<ast_node *>(&ast_arena);
         ast_cache.clear();
         ast_cache_index = 0;
         ast_coll_cache.clear();
         ast_reduce_cache.clear();
+        memo_fail.clear();
+        memo_track = memo_track_t{INT_MAX, 0, false};
         state_stack.push_back(0);
-        const auto &pdas = unit.get_pda();
+        const auto &pdas = grammar->get_pda();
         auto root = ast->new_node(a_collection);
         root->line = root->column = 0;
         root->data._coll = pdas[0].coll;
@@ -560,10 +711,12 @@ namespace clib {
         bk_tmp.coll_index = 0;
         bk_tmp.reduce_index = 0;
         bk_tmp.direction = b_next;
+        bk_tmp.memo_trans = -1;
         std::vector<backtrace_t> bks;
         bks.push_back(bk_tmp);
         auto trans_id = -1;
         auto prev_idx = 0;
+        auto compact_limit = (size_t) PSTACK_COMPACT;
         while (!bks.empty()) {
             auto bk = &bks.back();
             if (bk->direction == b_success || bk->direction == b_fail) {
@@ -572,6 +725,8 @@ namespace clib {
             if (bk->direction == b_fallback) {
                 if (bk->trans_ids.empty()) {
                     if (bks.size() > 1) {
+                        memo_track = bk->memo_outer;
+                        memo_merge(memo_track, bk->memo_acc);
                         bks.pop_back();
                         bks.back().direction = b_error;
                         bk = &bks.back();
@@ -589,6 +744,17 @@ namespace clib {
             state_stack = bk->state_stack;
             ast_stack = bk->ast_stack;
             auto state = bk->current_state;
+            if (state_arena.size() + ast_arena.size() > compact_limit) {
+                std::vector<persistent_stack<int> *> states{&state_stack, &bk_tmp.state_stack};
+                std::vector<persistent_stack<ast_node *> *> asts{&ast_stack, &bk_tmp.ast_stack};
+                for (auto &b : bks) {
+                    states.push_back(&b.state_stack);
+                    asts.push_back(&b.ast_stack);
+                }
+                persistent_stack<int>::compact(state_arena, states);
+                persistent_stack<ast_node *>::compact(ast_arena, asts);
+                compact_limit = std::max((size_t) PSTACK_COMPACT, (state_arena.size() + ast_arena.size()) * 4);
+            }
 
 #if TRACE_PARSING && !TRACE_PARSING_LOG
             {
@@ -619,6 +785,8 @@ namespace clib {
                     if (trans_id == -1 && !bk->trans_ids.empty()) {
                         trans_id = bk->trans_ids.back() & ((1 << 16) - 1);
                         bk->trans_ids.pop_back();
+                        bk->memo_trans = trans_id;
+                        memo_track = memo_track_t{INT_MAX, bk->lexer_index, false};
                     } else {
                         trans_ids.clear();
                         if (is_end) {
@@ -639,11 +807,13 @@ namespace clib {
                                 (trans[0].type == e_move || trans[0].type == e_pass) &&
                                 trans[0].marked) {
                                 prev_idx = bk->lexer_index;
+                                memo_track.dirty = true;
                             }
                         }
                         if (!trans_ids.empty()) {
                             std::sort(trans_ids.begin(), trans_ids.end(), std::greater<>());
                             if (current_state.pred) {
+                                memo_track.dirty = true;
                                 std::vector<int> then;
                                 std::vector<int> add;
                                 for (const auto t : trans_ids) {
@@ -664,7 +834,20 @@ namespace clib {
                                     std::copy(trans_ids.cbegin(), trans_ids.cend(), back_inserter(then));
                                 }
                             }
-                            if (trans_ids.size() > 1) {
+                            auto branch = trans_ids.size() > 1;
+#if MEMO_PARSING
+                            if (branch) {
+                                // 去掉在相同向前看单词下已知失败的分支
+                                trans_ids.erase(std::remove_if(trans_ids.begin(), trans_ids.end(), [&](int t) {
+                                    return memo_fail.find(memo_key(state, t)) != memo_fail.end();
+                                }), trans_ids.end());
+                                if (trans_ids.empty()) {
+                                    bk->direction = bk->lexer_index < prev_idx ? b_fail : b_error;
+                                    break;
+                                }
+                            }
+#endif
+                            if (branch) {
                                 bk_tmp.lexer_index = ast_cache_index;
                                 bk_tmp.state_stack = state_stack;
                                 bk_tmp.ast_stack = ast_stack;
@@ -673,6 +856,9 @@ namespace clib {
                                 bk_tmp.coll_index = ast_coll_cache.size();
                                 bk_tmp.reduce_index = ast_reduce_cache.size();
                                 bk_tmp.direction = b_next;
+                                bk_tmp.memo_trans = -1;
+                                bk_tmp.memo_outer = memo_track;
+                                bk_tmp.memo_acc = memo_track_t{INT_MAX, (int) ast_cache_index, false};
 #if DEBUG_AST
                                 for (auto i = 0; i < bks.size(); ++i) {
                                     auto &_bk = bks[i];
@@ -683,14 +869,14 @@ namespace clib {
                                             _bk.coll_index, _bk.reduce_index, _bk.ast_ids.size());
                                 }
 #endif
-                                bks.push_back(bk_tmp);
+                                bks.push_back(std::move(bk_tmp));
                                 bk = &bks.back();
 #if DEBUG_AST
                                 fprintf(stdout,
                                         "[DEBUG] Branch new: BS=%d, LI=%d, SS=%d, AS=%d, S=%d, TS=%d, CI=%d, RI=%d, TK=%d\n",
-                                        bks.size(), bk_tmp.lexer_index, bk_tmp.state_stack.size(),
-                                        bk_tmp.ast_stack.size(), bk_tmp.current_state, bk_tmp.trans_ids.size(),
-                                        bk_tmp.coll_index, bk_tmp.reduce_index, bk_tmp.ast_ids.size());
+                                        bks.size(), bk->lexer_index, bk->state_stack.size(),
+                                        bk->ast_stack.size(), bk->current_state, bk->trans_ids.size(),
+                                        bk->coll_index, bk->reduce_index, bk->ast_ids.size());
 #endif
                                 bk->direction = b_next;
                                 break;
@@ -778,6 +964,14 @@ namespace clib {
                     }
                 }
             if (bk->direction == b_error) {
+#if MEMO_PARSING
+                if (bk->memo_trans != -1) {
+                    if (!memo_track.dirty && memo_track.high == bk->lexer_index &&
+                        memo_track.low >= (int) bk->state_stack.size())
+                        memo_fail.insert(memo_key(bk->current_state, bk->memo_trans));
+                    memo_merge(bk->memo_acc, memo_track);
+                }
+#endif
 #if DEBUG_AST
                 for (auto i = 0; i < bks.size(); ++i) {
                     auto &_bk = bks[i];
@@ -828,6 +1022,7 @@ namespace clib {
             }
             trans_id = -1;
         }
+        return !bks.empty() && bks.back().direction == b_success;
     }
 
     ast_node *cjsparser::terminal() {
@@ -949,6 +1144,7 @@ namespace clib {
         switch (trans.type) {
             case e_reduce:
             case e_reduce_exp: {
+                memo_track.low = std::min(memo_track.low, (int) state_stack.size() - 1);
                 if (ast_stack.size() <= 1)
                     return false;
                 if (state_stack.empty())
@@ -969,7 +1165,7 @@ namespace clib {
                 state_stack.push_back(state);
                 auto new_node = ast->new_node(a_collection);
                 new_node->line = new_node->column = 0;
-                auto &pdas = unit.get_pda();
+                auto &pdas = grammar->get_pda();
                 new_node->data._coll = pdas[trans.jump].coll;
 #if DEBUG_AST
                 fprintf(stdout, "[DEBUG] Shift: top=%p, new=%p, CS=%d\n", ast_stack.back(), new_node,
@@ -987,6 +1183,7 @@ namespace clib {
 #else
                 terminal();
 #endif
+                memo_track.high = std::max(memo_track.high, (int) ast_cache_index);
 #if DEBUG_AST
                 fprintf(stdout, "[DEBUG] Move: parent=%p, child=%p, CS=%d\n", ast_stack.back(), t,
                         cjsast::children_size(ast_stack.back()));
@@ -996,6 +1193,7 @@ namespace clib {
             case e_move: {
                 bk.ast_ids.insert(ast_cache_index);
                 auto t = terminal();
+                memo_track.high = std::max(memo_track.high, (int) ast_cache_index);
 #if CHECK_AST
                 check_ast(t);
 #endif
@@ -1014,6 +1212,7 @@ namespace clib {
             case e_reduce_exp: {
                 auto new_ast = ast_stack.back();
                 check_ast(new_ast);
+                memo_track.low = std::min(memo_track.low, (int) state_stack.size() - 1);
                 if (new_ast->flag != a_collection) {
                     bk.ast_ids.insert(ast_cache_index);
                 }
@@ -1038,6 +1237,7 @@ namespace clib {
             }
                 break;
             case e_finish:
+                memo_track.low = std::min(memo_track.low, (int) state_stack.size() - 1);
                 state_stack.pop_back();
                 break;
             default:
@@ -1082,19 +1282,42 @@ namespace clib {
     }
 
     void cjsparser::error(const std::string &info) {
+        throw cexception(error_message(info));
+    }
+
+    std::string cjsparser::error_message(const std::string &info) const {
         std::stringstream ss;
         ss << '[' << std::setfill('0') << std::setw(4) << current->line;
         ss << ':' << std::setfill('0') << std::setw(3) << current->column;
         ss << ']' << ' ' << info;
-        throw cexception(ss.str());
+        return ss.str();
+    }
+
+    uint64_t cjsparser::memo_key(int state, int trans) const {
+        // 向前看单词：已缓存的取AST节点，否则取当前单词和换行标记
+        uint64_t la;
+        if (ast_cache_index < ast_cache.size()) {
+            auto &cache = ast_cache[ast_cache_index];
+            la = (uint64_t) cache->flag << 16 | (cache->flag == a_keyword ? cache->data._keyword :
+                                                 cache->flag == a_operator ? cache->data._op : 0);
+            la = la << 2 | 2;
+        } else {
+            la = (uint64_t) current->t << 2 | (current->newline ? 1 : 0);
+        }
+        return (uint64_t) state << 40 | (uint64_t) trans << 24 | la;
+    }
+
+    void cjsparser::memo_merge(memo_track_t &a, const memo_track_t &b) {
+        a.low = std::min(a.low, b.low);
+        a.high = std::max(a.high, b.high);
+        a.dirty = a.dirty || b.dirty;
     }
 
-    pda_coll_pred cjsparser::pred_for(const cjslexer *lexer, int idx) {
-        auto end = lexer->get_unit_size();
+    pda_coll_pred cjsparser::pred_for(cjslexer *lexer, int idx) {
         auto find_in = false;
-        for (auto i = idx + 1; i < end; i++) {
+        for (auto i = idx + 1;; i++) {
             const auto &U = lexer->get_unit(i);
-            if (U.t == T_SEMI) {
+            if (U.t == END || U.t == T_SEMI) {
                 break;
             }
             if (U.t == K_IN) {
@@ -1105,7 +1328,7 @@ namespace clib {
         return find_in ? p_DELAY : p_ALLOW;
     }
 
-    pda_coll_pred cjsparser::pred_in(const cjslexer *lexer, int idx) {
+    pda_coll_pred cjsparser::pred_in(cjslexer *lexer, int idx) {
         auto find_for = false;
         for (auto i = idx - 1; i >= 0; i--) {
             const auto &U = lexer->get_unit(i);
@@ -1122,7 +1345,7 @@ namespace clib {
         return find_for ? p_REMOVE : p_ALLOW;
     }
 
-    void cjsparser::clear_bk(const cjslexer *, int idx, std::vector<backtrace_t> &bks, backtrace_t *&bk) {
+    void cjsparser::clear_bk(cjslexer *, int idx, std::vector<backtrace_t> &bks, backtrace_t *&bk) {
         std::vector<backtrace_t> b(1);
         std::swap(b[0], bks.back());
         bks = b;
@@ -9,6 +9,7 @@
 #include <string>
 #include <memory>
 #include <unordered_set>
+#include "cjssource.h"
 #include "cjslexer.h"
 #include "cjsast.h"
 #include "cjsunit.h"
@@ -25,16 +26,77 @@ namespace clib {
         b_fallback,
     };
 
+    // 持久栈：节点存放在共享的数组中，复制只复制栈顶，回溯快照为O(1)
+    template<class T>
+    class persistent_stack {
+    public:
+        struct node_t {
+            T value;
+            int parent;
+            int size;
+        };
+        using arena_t = std::vector<node_t>;
+
+        persistent_stack() = default;
+        explicit persistent_stack(arena_t *arena) : arena(arena) {}
+
+        void push_back(const T &value) {
+            arena->push_back(node_t{value, top, (int) size() + 1});
+            top = (int) arena->size() - 1;
+        }
+        void pop_back() { top = (*arena)[top].parent; }
+        T back() const { return (*arena)[top].value; }
+        size_t size() const { return top == -1 ? 0 : (size_t) (*arena)[top].size; }
+        bool empty() const { return top == -1; }
+        void clear() { top = -1; }
+
+        // 只保留roots可达的节点
+        static void compact(arena_t &arena, const std::vector<persistent_stack *> &roots) {
+            arena_t new_arena;
+            std::vector<int> moved(arena.size(), -1);
+            std::vector<int> path;
+            for (auto &r : roots) {
+                for (auto i = r->top; i != -1 && moved[i] == -1; i = arena[i].parent)
+                    path.push_back(i);
+                for (auto i = path.rbegin(); i != path.rend(); ++i) {
+                    auto n = arena[*i];
+                    if (n.parent != -1)
+                        n.parent = moved[n.parent];
+                    moved[*i] = (int) new_arena.size();
+                    new_arena.push_back(n);
+                }
+                path.clear();
+                if (r->top != -1)
+                    r->top = moved[r->top];
+            }
+            arena.swap(new_arena);
+        }
+
+    private:
+        arena_t *arena{nullptr};
+        int top{-1};
+    };
+
+    // 分支内的探索范围，用于判断失败是否与上下文无关
+    struct memo_track_t {
+        int low;    // 读取过的最低状态栈位置
+        int high;   // 到达过的最远单词
+        bool dirty; // 依赖谓词或截断
+    };
+
     struct backtrace_t {
         int lexer_index;
-        std::vector<int> state_stack;
-        std::vector<ast_node *> ast_stack;
+        persistent_stack<int> state_stack;
+        persistent_stack<ast_node *> ast_stack;
         int current_state;
         uint32_t coll_index;
         uint32_t reduce_index;
         std::vector<int> trans_ids;
         std::unordered_set<int> ast_ids;
         backtrace_direction direction;
+        int memo_trans;
+        memo_track_t memo_outer;
+        memo_track_t memo_acc;
     };
 
     class csemantic {
@@ -51,12 +113,13 @@ namespace clib {
         cjsparser(const cjsparser &) = delete;
         cjsparser &operator=(const cjsparser &) = delete;
 
-        ast_node *parse(const std::string &str, std::string &, csemantic *s = nullptr);
+        ast_node *parse(const cjs_source &src, std::string &, csemantic *s = nullptr);
         ast_node *root() const;
         void clear_ast();
+        void set_threads(int n); // 大于1时按顶层语句分段并行分析
 
-        using pda_coll_pred_cb = pda_coll_pred(*)(const cjslexer *, int idx);
-        using terminal_cb = void (*)(const cjslexer *, int idx,
+        using pda_coll_pred_cb = pda_coll_pred(*)(cjslexer *, int idx);
+        using terminal_cb = void (*)(cjslexer *, int idx,
                                      std::vector<backtrace_t> &bks, backtrace_t *&bk);
 
     private:
@@ -64,7 +127,9 @@ namespace clib {
         void next();
 
         void gen();
-        void program();
+        bool program();
+        void release();
+        ast_node *parse_parallel(const cjs_source &src);
         ast_node *terminal();
 
         bool valid_trans(const pda_trans &trans) const;
@@ -75,23 +140,35 @@ namespace clib {
         void match_type(lexer_t);
 
         void error(const std::string &);
+        std::string error_message(const std::string &) const;
+
+        uint64_t memo_key(int state, int trans) const;
+        static void memo_merge(memo_track_t &a, const memo_track_t &b);
 
-        static pda_coll_pred pred_for(const cjslexer *, int idx);
-        static pda_coll_pred pred_in(const cjslexer *, int idx);
-        static void clear_bk(const cjslexer *, int idx,
+        static pda_coll_pred pred_for(cjslexer *, int idx);
+        static pda_coll_pred pred_in(cjslexer *, int idx);
+        static void clear_bk(cjslexer *, int idx,
                              std::vector<backtrace_t> &bks, backtrace_t *&bk);
 
     private:
         const lexer_unit *current{nullptr};
-        std::vector<int> state_stack;
-        std::vector<ast_node *> ast_stack;
+        persistent_stack<int>::arena_t state_arena;
+        persistent_stack<ast_node *>::arena_t ast_arena;
+        persistent_stack<int> state_stack;
+        persistent_stack<ast_node *> ast_stack;
         std::vector<ast_node *> ast_cache;
         size_t ast_cache_index{0};
         std::vector<ast_node *> ast_coll_cache;
         std::vector<ast_node *> ast_reduce_cache;
+        mutable memo_track_t memo_track{};
+        // 不消耗单词即失败的分支：(状态, 分支, 向前看单词)
+        std::unordered_set<uint64_t> memo_fail;
 
     private:
         cjsunit unit;
+        cjsunit *grammar{&unit};
+        int threads{1};
+        std::vector<std::unique_ptr<cjsparser>> chunks;
         std::unique_ptr<cjslexer> lexer;
         csemantic *semantic{nullptr};
         std::unique_ptr<cjsast> ast;
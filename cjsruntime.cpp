@@ -11,7 +11,7 @@
 #include <iterator>
 #include <fstream>
 #include <utility>
-#include <regex>
+#include <thread>
 #include "cjsruntime.h"
 #include "cjsast.h"
 #include "cjs.h"
@@ -22,15 +22,26 @@
 #define DUMP_GC 0
 #define SHOW_EXTRA 1
 #define GC_PERIOD 128
+#define QUICKEN 1
+#define QUICKEN_THRESHOLD 2
+#define QUICKEN_DEOPT_LIMIT 4
+#define JIT_THRESHOLD 64
+// 嵌套call_internal的层数上限：Release每层约1.2KB栈，8MB栈约6500层崩溃；Debug+ASan每层约24KB
+#ifdef NDEBUG
+#define MAX_NATIVE_DEPTH 1024
+#else
+#define MAX_NATIVE_DEPTH 256
+#endif
+#define OUTPUT_BUFFER_SIZE 8192
 
 #if defined(WIN32) || defined(WIN64)
 
-#include <windows.h>
+#include <io.h>
 
-#define cjs_sleep(n) Sleep(n)
+#define cjs_isatty(f) _isatty(_fileno(f))
 #else
 #include <unistd.h>
-#define cjs_sleep(n) sleep(n / 1000)
+#define cjs_isatty(f) isatty(fileno(f))
 #endif
 
 namespace clib {
@@ -55,9 +66,20 @@ namespace clib {
     }
 
     int cjsruntime::eval(cjs_code_result::ref code, const std::string &_path, bool top) {
-        if (code->code->codes.empty()) {
-            return exec(jsv_string::convert(_path), "throw new SyntaxError('Compile error')");
+        auto info = load(code);
+        if (!info) {
+            return eval_error(ERROR_SyntaxError, "Compile error", _path, top);
         }
+        return eval(info, _path, top);
+    }
+
+    cjs_function_info::ref cjsruntime::load(const cjs_code_result::ref &code) {
+        if (code->code->codes.empty())
+            return nullptr;
+        return std::make_shared<cjs_function_info>(code->code, *this);
+    }
+
+    int cjsruntime::eval(const cjs_function_info::ref &info, const std::string &_path, bool top) {
         if (_path.empty() || _path[0] == '<') {
             paths.emplace_back(ROOT_DIR);
         } else {
@@ -76,16 +98,18 @@ namespace clib {
             }
         }
         if (top) {
-            stack.clear();
-            auto top_stack = std::make_shared<cjs_function>(code->code, *this);
+            while (!stack.empty()) {
+                delete_stack(stack.back());
+                stack.pop_back();
+            }
+            auto top_stack = new_stack(info);
             stack.push_back(top_stack);
             current_stack = stack.back();
             current_stack->envs = permanents.global_env;
             current_stack->_this = permanents.global_env;
             current_stack->_try.push_back(std::make_shared<sym_try_t>(sym_try_t{}));
         } else {
-            auto exec_stack = std::make_shared<cjs_function>(code->code, *this);
-            exec_stack->envs = new_object();
+            auto exec_stack = new_stack(info);
             exec_stack->_this = stack.front()->envs;
             stack.push_back(exec_stack);
             current_stack = stack.back();
@@ -93,13 +117,20 @@ namespace clib {
         }
         auto result = call_internal(true, 0);
         if (result == 0) {
-            if (current_stack->ret_value.lock())
-                std::cout << current_stack->ret_value.lock()->to_string(this, 1) << std::endl;
-            eval_timeout();
-            delete_stack(current_stack);
-            stack.pop_back();
+            if (current_stack->ret_value.lock()) {
+                write(OUTPUT_STDOUT, current_stack->ret_value.lock()->to_string(this, 1));
+                write(OUTPUT_STDOUT, '\n');
+            }
+            if (auto_loop) {
+                run_until_idle();
+                delete_stack(current_stack);
+                stack.pop_back();
+            } else {
+                run_microtasks();
+            }
             paths.pop_back();
         }
+        flush_output();
         return result;
     }
 
@@ -109,14 +140,33 @@ namespace clib {
         auto has_throw = false;
         sym_try_t::ref _try;
         while (stack.size() > stack_size) {
-            const auto &codes = current_stack->info->codes;
+            auto &codes = current_stack->info->codes;
             const auto &pc = current_stack->pc;
-            while (true) {
+            if (current_stack->reg) {
+                const auto &rcodes = current_stack->info->rcodes;
+                while (true) {
+                    if (pc >= (int) rcodes.size()) {
+                        r = 4;
+                        break;
+                    }
+                    r = run_reg(rcodes[pc]);
+                    steps++;
+                    if (gc_period++ >= GC_PERIOD) {
+                        gc_period = 0;
+                        gc();
+                    }
+                    if (r != 0)
+                        break;
+                }
+            } else if (jit_threshold >= 0 && current_stack->info->hotness >= jit_threshold &&
+                       cjsjit::compile(*current_stack->info)) {
+                r = cjsjit::call(*this);
+            } else while (true) {
                 if (pc >= (int) codes.size()) {
                     r = 4;
                     break;
                 }
-                const auto &c = codes.at(pc);
+                auto &c = codes.at(pc);
                 if (pc + 1 == (int) codes.size() && c.code == POP_TOP) {
                     r = 2;
                     break;
@@ -125,6 +175,7 @@ namespace clib {
                 dump_step(c);
 #endif
                 r = run(c);
+                steps++;
 #if DUMP_STEP && SHOW_EXTRA
                 dump_step2(c);
 #endif
@@ -152,34 +203,38 @@ namespace clib {
             }
             if (r == 9) { // throw
                 _try = get_try();
-                if (_try && _try->stack_size > 0 && _try->stack_size <= stack.size() && _try->obj_size <= current_stack->stack.size()) {
-                    if (_try->stack_size <= stack.size()) {
-                        for (auto s = stack.size(); s > _try->stack_size; s--) {
-                            delete_stack(stack.back());
-                            stack.pop_back();
-                        }
-                        current_stack = stack.back();
+                while (_try && _try->stack_size > stack_size && _try->jump_catch == 0 && _try->jump_finally == 0) {
+                    // catch block without finally, pass to the enclosing handler
+                    auto obj = _try->obj;
+                    auto &tr = stack.at(_try->stack_size - 1)->_try;
+                    assert(!tr.empty() && tr.back() == _try);
+                    tr.pop_back();
+                    _try = get_try();
+                    if (_try)
+                        _try->obj = obj;
+                }
+                if (_try && _try->stack_size > stack_size && _try->stack_size <= stack.size()) {
+                    for (auto s = stack.size(); s > _try->stack_size; s--) {
+                        delete_stack(stack.back());
+                        stack.pop_back();
                     }
-                    if (_try->obj_size <= current_stack->stack.size()) {
-                        for (auto s = current_stack->stack.size(); s > _try->obj_size; s--) {
-                            pop();
-                        }
+                    current_stack = stack.back();
+                    for (auto s = current_stack->stack.size(); s > _try->obj_size; s--) {
+                        pop();
                     }
+                    if (_try->obj.lock())
+                        push(_try->obj);
+                    else
+                        push(new_undefined());
                     if (_try->jump_catch != 0) {
-                        if (_try->obj.lock())
-                            push(_try->obj);
-                        else
-                            push(new_undefined());
                         current_stack->pc = _try->jump_catch;
                         _try->jump_catch = 0;
-                    } else if (_try->jump_finally != 0) {
-                        current_stack->pc = _try->jump_finally;
-                    }
-                    if (_try->jump_finally == 0) {
+                    } else {
                         assert(!current_stack->_try.empty());
                         current_stack->_try.pop_back();
-                        _try = nullptr;
+                        current_stack->pc = _try->jump_finally;
                     }
+                    _try = nullptr;
                     continue;
                 }
                 has_throw = true;
@@ -209,17 +264,24 @@ namespace clib {
                 current_stack = stack.back();
                 current_stack->stack.clear();
                 if (obj) {
-                    std::cerr << "Uncaught " << obj->to_string(this, 1) << std::endl;
+                    write(OUTPUT_STDERR, "Uncaught ");
+                    write(OUTPUT_STDERR, obj->to_string(this, 1));
+                    write(OUTPUT_STDERR, '\n');
                 }
+                flush_output();
             } else {
+                for (auto s = stack.size(); s > stack_size; s--) {
+                    delete_stack(stack.back());
+                    stack.pop_back();
+                }
+                current_stack = stack.back();
                 return 9;
             }
         }
         return 0;
     }
 
-    int cjsruntime::call_api(int type, js_value::weak_ref &_this,
-                             std::vector<js_value::weak_ref> &args, uint32_t attr) {
+    int cjsruntime::call_api(int type, js_value::weak_ref &_this, cjs_args args, uint32_t attr) {
         switch ((js_value_new::api) type) {
             case API_none:
                 break;
@@ -254,6 +316,13 @@ namespace clib {
                 push(new_undefined());
             }
                 break;
+            case API_queueMicrotask: {
+                if (args.empty() || args.front().lock()->get_type() != r_function)
+                    return throw_error(ERROR_TypeError, "queueMicrotask: callback is not a function");
+                microtasks.push_back(job_t{JS_FUN(args.front().lock())});
+                push(new_undefined());
+            }
+                break;
             default:
                 break;
         }
@@ -261,7 +330,7 @@ namespace clib {
     }
 
     int cjsruntime::call_api(const jsv_function::ref &func, js_value::weak_ref &_this,
-                             std::vector<js_value::weak_ref> &args, uint32_t attr) {
+                             cjs_args args, uint32_t attr) {
         assert(_this.lock());
         auto stack_size = stack.size();
         bool fast = attr & jsv_function::at_fast;
@@ -270,6 +339,9 @@ namespace clib {
         }
         if (func->builtin)
             return func->builtin(current_stack, _this, args, *this, attr);
+        if (stack.size() >= max_depth || (!fast && native_depth >= MAX_NATIVE_DEPTH))
+            return throw_error(ERROR_RangeError, "Maximum call stack size exceeded");
+        func->code->load(*this);
         auto _new_stack = new_stack(func->code);
         stack.push_back(_new_stack);
         auto env = _new_stack->envs.lock();
@@ -283,11 +355,9 @@ namespace clib {
         size_t args_num = func->code->args_num;
         auto n = args.size();
         for (; i < n; i++) {
-            std::stringstream ss;
-            ss << i;
-            arg->obj[ss.str()] = args.at(i);
+            arg->obj[std::to_string(i)] = args[i];
             if (i < args_num)
-                env->obj[func->code->args.at(i)] = args.at(i);
+                env->obj[func->code->args.at(i)] = args[i];
         }
         for (; i < args_num; i++) {
             env->obj[func->code->args.at(i)] = new_undefined();
@@ -297,25 +367,33 @@ namespace clib {
             env->obj[func->code->args.at(args_num)] = rest;
             auto j = 0;
             for (i = args_num; i < n; i++) {
-                std::stringstream ss;
-                ss << j++;
-                rest->obj[ss.str()] = args.at(i);
+                rest->obj[std::to_string(j++)] = args[i];
             }
             rest->obj["length"] = new_number(j);
         }
         arg->obj["length"] = new_number(n);
         if (func->closure.lock())
             _new_stack->closure = func->closure;
+        if (jit_threshold >= 0 && func->code->jit_state == 0)
+            func->code->hotness++;
+        if (register_vm && func->code->load_reg()) {
+            _new_stack->reg = true;
+            _new_stack->stack.resize(func->code->reg_size);
+            _new_stack->slots.assign(func->code->names.size(), nullptr);
+        }
         if (fast) {
             current_stack->pc++;
             return 1;
         }
         current_stack = _new_stack;
-        return call_internal(false, stack_size);
+        native_depth++;
+        auto r = call_internal(false, stack_size);
+        native_depth--;
+        return r;
     }
 
     js_value::ref cjsruntime::fast_api(const jsv_function::ref &func, js_value::weak_ref &_this,
-                                       std::vector<js_value::weak_ref> &args, uint32_t attr, int *r) {
+                                       cjs_args args, uint32_t attr, int *r) {
         auto ret = call_api(func, _this, args, attr);
         if (r)
             *r = ret;
@@ -325,18 +403,15 @@ namespace clib {
     }
 
     double cjsruntime::api_setTimeout(int time, const jsv_function::ref &func, std::vector<js_value::weak_ref> args, uint32_t attr, bool once) {
-        auto t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) - timeout.startup_time;
-        if (timeout.queues.find(t) == timeout.queues.end()) {
-            timeout.queues[t] = std::list<std::shared_ptr<timeout_t>>();
-        }
         auto s = std::make_shared<timeout_t>();
         s->once = once;
-        s->time = time;
+        s->time = std::max(time, 0);
         s->id = timeout.global_id++;
+        s->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(s->time);
         s->func = func;
         s->args = std::move(args);
         s->attr = attr;
-        timeout.queues[t].push_back(s);
+        timeout.queues.insert(s);
         timeout.ids.insert({s->id, s});
         return (double) s->id;
     }
@@ -344,43 +419,239 @@ namespace clib {
     void cjsruntime::api_clearTimeout(double id) {
         if (std::isinf(id) || std::isnan(id))
             return;
-        auto i = (uint32_t) id;
-        auto f = timeout.ids.find(i);
+        auto f = timeout.ids.find((uint32_t) id);
         if (f != timeout.ids.end()) {
-            auto time = f->second->time;
-            auto ff = timeout.queues.find(time);
-            if (ff != timeout.queues.end()) {
-                auto f2 = std::find_if(ff->second.begin(), ff->second.end(),
-                                       [i](const auto &x) { return x->id == i; });
-                if (f2 != ff->second.end()) {
-                    ff->second.erase(f2);
-                }
+            // 已取出等待执行的任务靠cleared跳过
+            f->second->cleared = true;
+            timeout.queues.erase(f->second);
+            timeout.ids.erase(f);
+        }
+    }
+
+    int cjsruntime::call_guarded(const jsv_function::ref &func, js_value::weak_ref &_this,
+                                 cjs_args args, uint32_t attr, js_value::ref &ret) {
+        auto stack_size = stack.size();
+        auto obj_size = current_stack->stack.size();
+        auto _try = std::make_shared<sym_try_t>();
+        current_stack->_try.push_back(_try);
+        auto r = call_api(func, _this, args, attr);
+        if (r == 9) {
+            for (auto s = stack.size(); s > stack_size; s--) {
+                delete_stack(stack.back());
+                stack.pop_back();
             }
-            if (ff->second.empty()) {
-                timeout.queues.erase(ff);
+            current_stack = stack.back();
+            ret = _try->obj.lock();
+        } else if (current_stack->stack.size() > obj_size) {
+            ret = pop().lock();
+        }
+        for (auto s = current_stack->stack.size(); s > obj_size; s--) {
+            pop();
+        }
+        auto &tr = current_stack->_try;
+        auto f = std::find(tr.begin(), tr.end(), _try);
+        if (f != tr.end())
+            tr.erase(f, tr.end());
+        return r;
+    }
+
+    int cjsruntime::call_job(job_t &job) {
+        if (job.timer && job.timer->cleared)
+            return 0;
+        js_value::ref ret;
+        js_value::weak_ref env = stack.front()->envs;
+        auto r = call_guarded(job.func, env, job.args, job.attr, ret);
+        if (r == 9) {
+            if (ret) {
+                write(OUTPUT_STDERR, "Uncaught ");
+                write(OUTPUT_STDERR, ret->to_string(this, 1));
+                write(OUTPUT_STDERR, '\n');
+            }
+            flush_output();
+        }
+        if (job.timer && !job.timer->cleared) {
+            const auto &t = job.timer;
+            if (t->once) {
+                timeout.ids.erase(t->id);
+            } else {
+                t->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(t->time, 1));
+                timeout.queues.insert(t);
             }
-            timeout.ids.erase(i);
         }
+        return r;
     }
 
-    void cjsruntime::eval_timeout() {
-        while (!timeout.ids.empty()) {
-            auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) - timeout.startup_time;
-            if ((*timeout.queues.begin()).first < now) {
-                auto &v = (*timeout.queues.begin()).second;
-                auto callback = v.front();
-                js_value::weak_ref env = stack.front()->envs;
-                call_api(callback->func, env, callback->args, callback->attr);
-                v.pop_front();
-                if (v.empty()) {
-                    timeout.queues.erase(timeout.queues.begin());
-                }
-                timeout.ids.erase(callback->id);
-                if (!callback->once) {
-                    api_setTimeout(callback->time, callback->func, callback->args, callback->attr, callback->once);
-                }
-            }
-            cjs_sleep(10);
+    void cjsruntime::run_microtasks() {
+        while (!microtasks.empty()) {
+            auto job = std::move(microtasks.front());
+            microtasks.pop_front();
+            call_job(job);
+        }
+    }
+
+    bool cjsruntime::pop_task() {
+        auto now = std::chrono::steady_clock::now();
+        while (!timeout.queues.empty()) {
+            auto i = timeout.queues.begin();
+            const auto &t = *i;
+            if (t->deadline > now)
+                break;
+            macrotasks.push_back(job_t{t->func, t->args, t->attr, t});
+            timeout.queues.erase(i);
+        }
+        return !macrotasks.empty();
+    }
+
+    bool cjsruntime::run_one_task() {
+        if (stack.empty())
+            return false;
+        run_microtasks();
+        if (!pop_task())
+            return false;
+        auto job = std::move(macrotasks.front());
+        macrotasks.pop_front();
+        call_job(job);
+        run_microtasks();
+        return true;
+    }
+
+    void cjsruntime::run_until_idle() {
+        while (true) {
+            if (run_one_task())
+                continue;
+            if (stack.empty() || timeout.queues.empty())
+                break;
+            flush_output();
+            std::this_thread::sleep_until((*timeout.queues.begin())->deadline);
+        }
+        flush_output();
+    }
+
+    void cjsruntime::set_auto_loop(bool flag) {
+        auto_loop = flag;
+    }
+
+    void cjsruntime::set_register_vm(bool flag) {
+        register_vm = flag;
+    }
+
+    void cjsruntime::set_jit(bool enable, bool force) {
+        jit_threshold = enable ? (force ? 0 : JIT_THRESHOLD) : -1;
+    }
+
+    void cjsruntime::set_max_depth(size_t depth) {
+        max_depth = depth;
+    }
+
+    uint64_t cjsruntime::get_steps() const {
+        return steps;
+    }
+
+    js_value::ref cjsruntime::get_global(const std::string &name) const {
+        const auto &o = permanents.global_env->obj;
+        auto f = o.find(name);
+        if (f == o.end())
+            return nullptr;
+        return f->second.lock();
+    }
+
+    int cjsruntime::call(const cjs_function_info::ref &base, const jsv_function::ref &func,
+                         std::vector<js_value::weak_ref> &args, js_value::ref &ret) {
+        if (stack.empty()) {
+            // kept until the next top-level eval, so later calls and conversions of ret reuse it
+            auto base_stack = new_stack(base);
+            base_stack->envs = permanents.global_env;
+            base_stack->_this = permanents.global_env;
+            base_stack->pc = (int) base->codes.size();
+            stack.push_back(base_stack);
+            current_stack = stack.back();
+        }
+        js_value::weak_ref env = permanents.global_env;
+        auto r = call_guarded(func, env, args, 0, ret);
+        if (!ret)
+            ret = new_undefined();
+        if (auto_loop)
+            run_until_idle();
+        else
+            run_microtasks();
+        flush_output();
+        return r;
+    }
+
+    cjsruntime::~cjsruntime() {
+        flush_output();
+    }
+
+    void cjsruntime::write(output_t type, const std::string &s) {
+        auto &out = outputs[type];
+        if (!out.file)
+            return;
+        flush_others(type);
+        out.buffer.append(s);
+        switch (out.policy) {
+            case FLUSH_LINE:
+                if (s.find('\n') != std::string::npos)
+                    flush_output(type);
+                break;
+            case FLUSH_BLOCK:
+                if (out.buffer.size() >= OUTPUT_BUFFER_SIZE)
+                    flush_output(type);
+                break;
+            default:
+                flush_output(type);
+                break;
+        }
+    }
+
+    void cjsruntime::write(output_t type, char c) {
+        auto &out = outputs[type];
+        if (!out.file)
+            return;
+        flush_others(type);
+        out.buffer.push_back(c);
+        switch (out.policy) {
+            case FLUSH_LINE:
+                if (c == '\n')
+                    flush_output(type);
+                break;
+            case FLUSH_BLOCK:
+                if (out.buffer.size() >= OUTPUT_BUFFER_SIZE)
+                    flush_output(type);
+                break;
+            default:
+                flush_output(type);
+                break;
+        }
+    }
+
+    void cjsruntime::set_flush_policy(output_t type, flush_policy_t policy) {
+        auto &out = outputs[type];
+        flush_output(type);
+        if (policy == FLUSH_AUTO) // stderr不做块缓冲
+            policy = (type == OUTPUT_STDERR || (out.file && cjs_isatty(out.file))) ? FLUSH_LINE : FLUSH_BLOCK;
+        out.policy = policy;
+    }
+
+    void cjsruntime::flush_output() {
+        for (auto i = 0; i < OUTPUT_END; i++) {
+            flush_output((output_t) i);
+        }
+    }
+
+    void cjsruntime::flush_output(output_t type) {
+        auto &out = outputs[type];
+        if (!out.file || out.buffer.empty())
+            return;
+        fwrite(out.buffer.data(), 1, out.buffer.size(), out.file);
+        fflush(out.file);
+        out.buffer.clear();
+    }
+
+    void cjsruntime::flush_others(output_t type) {
+        // 换流写入前先排空其它流，任何时刻至多一个流有缓冲，输出顺序与写入顺序一致
+        for (auto i = 0; i < OUTPUT_END; i++) {
+            if (i != type)
+                flush_output((output_t) i);
         }
     }
 
@@ -398,7 +669,7 @@ namespace clib {
         readonly = flag;
     }
 
-    int cjsruntime::run(const cjs_code &code) {
+    int cjsruntime::run(cjs_code &code) {
         switch (code.code) {
             case LOAD_EMPTY: {
                 js_value::ref v;
@@ -551,10 +822,43 @@ namespace clib {
             case BINARY_AND:
             case BINARY_XOR:
             case BINARY_OR: {
-                auto op2 = pop().lock();
-                auto op1 = pop().lock();
+#if QUICKEN
+                const auto &st = current_stack->stack;
+                auto op2 = st[st.size() - 1].lock();
+                auto op1 = st[st.size() - 2].lock();
+                if (op1->get_type() == r_number && op2->get_type() == r_number &&
+                    code.code != BINARY_FLOOR_DIVIDE) {
+                    auto op = code.code;
+                    if (observe(code)) {
+                        code.code = BINARY_NUMBER;
+                        code.op1 = op;
+                    }
+                    pop();
+                    pop();
+                    push(binop_number(op, JS_NUM(op1), JS_NUM(op2)));
+                    break;
+                }
+#endif
                 auto r = 0;
-                auto ret = binop(code.code, op1, op2, &r);
+                auto ret = binop_top(code.code, &r);
+                if (r != 0)
+                    return r;
+                push(ret);
+            }
+                break;
+            case BINARY_NUMBER: {
+                const auto &st = current_stack->stack;
+                auto op2 = st[st.size() - 1].lock();
+                auto op1 = st[st.size() - 2].lock();
+                if (op1->get_type() == r_number && op2->get_type() == r_number) {
+                    pop();
+                    pop();
+                    push(binop_number(code.op1, JS_NUM(op1), JS_NUM(op2)));
+                    break;
+                }
+                deopt(code);
+                auto r = 0;
+                auto ret = binop_top(code.code, &r);
                 if (r != 0)
                     return r;
                 push(ret);
@@ -562,18 +866,53 @@ namespace clib {
                 break;
             case LOAD_ATTR:
             case BINARY_SUBSCR: {
-                auto key = code.code == LOAD_ATTR ?
-                           current_stack->info->names.at(code.op1) :
-                           pop().lock()->to_string(this, 0);
+                js_value::ref index;
+                if (code.code == BINARY_SUBSCR)
+                    index = pop().lock();
+                auto key = index ? index->to_string(this, 0) : current_stack->info->names.at(code.op1);
                 auto obj = pop().lock();
-                if (!obj->is_primitive()) {
-                    auto value = JS_O(obj)->get(key);
-                    if (value) {
-                        push(value);
+#if QUICKEN
+                if (obj->get_type() == r_object) {
+                    auto hit = index ?
+                               index->get_type() == r_number && obj->__proto__.lock() == permanents._proto_array :
+                               JS_OBJ(obj).find(key) != JS_OBJ(obj).end();
+                    if (hit && observe(code))
+                        code.code = index ? BINARY_SUBSCR_INDEX : LOAD_ATTR_OWN;
+                }
+#endif
+                push(load_attr(obj, key));
+            }
+                break;
+            case BINARY_SUBSCR_INDEX: {
+                auto index = pop().lock();
+                auto obj = pop().lock();
+                if (obj->get_type() == r_object && index->get_type() == r_number) {
+                    auto i = JS_NUM(index);
+                    if (i >= 0 && i < 2147483648.0 && i == std::floor(i)) {
+                        push(load_attr(obj, std::to_string((int) i)));
                         break;
                     }
                 }
-                push(permanents._undefined);
+                deopt(code);
+                push(load_attr(obj, index->to_string(this, 0)));
+            }
+                break;
+            case LOAD_ATTR_OWN: {
+                auto obj = pop().lock();
+                const auto &key = current_stack->info->names.at(code.op1);
+                if (obj->get_type() == r_object) {
+                    const auto &o = JS_OBJ(obj);
+                    auto f = o.find(key);
+                    if (f != o.end()) {
+                        auto value = f->second.lock();
+                        if (value) {
+                            push(value);
+                            break;
+                        }
+                    }
+                }
+                deopt(code);
+                push(load_attr(obj, key));
             }
                 break;
             case BINARY_INC:
@@ -597,8 +936,12 @@ namespace clib {
                 auto &o = JS_OBJ(obj);
                 if (!obj->is_primitive()) {
                     auto f = o.find(key);
-                    if (f != o.end() && (readonly && (f->second.lock()->attr & js_value::at_readonly))) {
-                        break;
+                    if (readonly && f != o.end()) {
+                        auto v = f->second.lock();
+                        // 只读的基本类型是共享常量，只在内建对象里才表示该属性只读
+                        if ((v->attr & js_value::at_readonly) &&
+                            (!v->is_primitive() || (obj->attr & js_value::at_readonly)))
+                            break;
                     }
                     o[key] = std::move(value);
                     break;
@@ -608,6 +951,7 @@ namespace clib {
             case GET_ITER: {
                 auto obj = top().lock();
                 if (obj->get_type() == r_object) {
+                    load_stack(JS_O(obj));
                     auto &o = JS_OBJ(obj);
                     pop();
                     auto arr = new_array();
@@ -760,8 +1104,12 @@ namespace clib {
                 auto &o = JS_OBJ(obj);
                 if (!obj->is_primitive()) {
                     auto f = o.find(key);
-                    if (f != o.end() && (readonly && (f->second.lock()->attr & js_value::at_readonly))) {
-                        break;
+                    if (readonly && f != o.end()) {
+                        auto v = f->second.lock();
+                        // 只读的基本类型是共享常量，只在内建对象里才表示该属性只读
+                        if ((v->attr & js_value::at_readonly) &&
+                            (!v->is_primitive() || (obj->attr & js_value::at_readonly)))
+                            break;
                     }
                     o[key] = std::move(value);
                     break;
@@ -863,7 +1211,11 @@ namespace clib {
                 break;
             case JUMP_ABSOLUTE: {
                 auto jmp = code.op1;
+                auto back = jmp <= current_stack->pc;
                 current_stack->pc = jmp;
+                if (back && jit_threshold >= 0 && current_stack->info->jit_state == 0 &&
+                    ++current_stack->info->hotness >= jit_threshold)
+                    return 3; // 循环变热，回到call_internal切换到机器码
                 return 0;
             }
             case POP_JUMP_IF_FALSE: {
@@ -890,14 +1242,8 @@ namespace clib {
                 if (var) {
                     push(var);
                 } else {
-                    auto name = current_stack->info->globals.at(op);
-                    std::stringstream ss;
-                    ss << "throw new ReferenceError('" << jsv_string::convert(name) << " is not defined')";
-                    auto _stack_size = stack.size();
-                    auto r = exec("<error>", ss.str());
-                    if (r != 0)
-                        return r;
-                    return call_internal(false, _stack_size);
+                    const auto &name = current_stack->info->globals.at(op);
+                    return throw_error(ERROR_ReferenceError, name + " is not defined");
                 }
             }
                 break;
@@ -913,12 +1259,31 @@ namespace clib {
                 _try->obj = pop().lock();
             }
                 return 9;
-            case POP_FINALLY:
-                return 9;
+            case POP_FINALLY: {
+                assert(!current_stack->_try.empty());
+                auto _try = current_stack->_try.back();
+                current_stack->_try.pop_back();
+                if (_try->jump_finally != 0) {
+                    js_value::ref v;
+                    push(v);
+                }
+                current_stack->pc += code.op1;
+            }
+                return 0;
             case EXIT_FINALLY:
                 assert(!current_stack->_try.empty());
                 current_stack->_try.pop_back();
                 break;
+            case END_FINALLY: {
+                auto obj = pop();
+                if (obj.lock()) {
+                    auto _try = get_try();
+                    assert(_try);
+                    _try->obj = obj;
+                    return 9;
+                }
+            }
+                break;
             case LOAD_FAST: {
                 auto op = code.op1;
                 auto var = load_fast(op);
@@ -932,6 +1297,68 @@ namespace clib {
                 current_stack->store_fast(name, obj);
             }
                 break;
+            case LOAD_FAST_FAST:
+                push(load_fast(code.op1));
+                push(load_fast(code.op2));
+                break;
+            case LOAD_FAST_ATTR: {
+                auto obj = load_fast(code.op1);
+                push(load_attr(obj, current_stack->info->names.at(code.op2)));
+            }
+                break;
+            case STORE_FAST_POP: {
+                auto obj = pop();
+                const auto &name = current_stack->info->names.at(code.op1);
+                current_stack->store_fast(name, obj);
+            }
+                break;
+            case INC_FAST:
+            case DEC_FAST: {
+                auto op1 = load_fast(code.op1);
+                auto r = 0;
+                auto ret = binop(
+                        code.code == INC_FAST ? BINARY_ADD : BINARY_SUBTRACT,
+                        op1,
+                        permanents._one, &r);
+                if (r != 0)
+                    return r;
+                assert(ret);
+                const auto &name = current_stack->info->names.at(code.op1);
+                current_stack->store_fast(name, ret);
+                if (code.op2 == 0)
+                    push(op1);
+                else if (code.op2 == 1)
+                    push(ret);
+            }
+                break;
+            case COMPARE_JUMP_IF_FALSE:
+            case COMPARE_NUMBER_JUMP_IF_FALSE: {
+                const auto &st = current_stack->stack;
+                auto op2 = st[st.size() - 1].lock();
+                auto op1 = st[st.size() - 2].lock();
+                js_value::ref ret;
+                if (op1->get_type() == r_number && op2->get_type() == r_number) {
+#if QUICKEN
+                    if (code.code == COMPARE_JUMP_IF_FALSE && observe(code))
+                        code.code = COMPARE_NUMBER_JUMP_IF_FALSE;
+#endif
+                    pop();
+                    pop();
+                    ret = binop_number(code.op2, JS_NUM(op1), JS_NUM(op2));
+                } else {
+                    if (code.code == COMPARE_NUMBER_JUMP_IF_FALSE)
+                        deopt(code);
+                    auto r = 0;
+                    ret = binop_top(code.op2, &r);
+                    if (r != 0)
+                        return r;
+                }
+                if (!ret->to_bool()) {
+                    current_stack->pc = code.op1;
+                    return 0;
+                }
+            }
+                break;
             case CALL_FUNCTION: {
                 auto n = code.op1;
                 if (n == -1) {
@@ -940,20 +1367,19 @@ namespace clib {
                     current_stack->rests.pop_back();
                 }
                 assert((int) current_stack->stack.size() > n);
-                std::vector<js_value::weak_ref> args;
-                args.resize(n);
-                auto m = n;
-                while (m-- > 0) {
-                    args[m] = pop();
-                }
-                auto f = pop();
-                if (f.lock()->get_type() != r_function) {
+                auto frame = current_stack.get();
+                size_t base;
+                auto args = call_window(n, base);
+                auto f = frame->stack[base - 1].lock();
+                if (f->get_type() != r_function) {
+                    drop_args(frame, base - 1, n + 1);
                     push(new_undefined());
                     break;
                 }
-                auto func = JS_FUN(f.lock());
+                auto func = JS_FUN(f);
                 js_value::weak_ref _this = JS_V(stack.front()->envs.lock());
                 auto r = call_api(func, _this, args, jsv_function::at_fast);
+                drop_args(frame, base - 1, n + 1);
                 if (r != 0)
                     return r;
             }
@@ -1031,17 +1457,16 @@ namespace clib {
                     current_stack->rests.pop_back();
                 }
                 assert((int) current_stack->stack.size() > n);
-                std::vector<js_value::weak_ref> args(n);
-                auto m = n;
-                while (m-- > 0) {
-                    args[m] = pop();
-                }
-                auto f = pop();
-                if (f.lock()->get_type() != r_function) {
+                auto frame = current_stack.get();
+                size_t base;
+                auto args = call_window(n, base);
+                auto f = frame->stack[base - 1].lock();
+                if (f->get_type() != r_function) {
+                    drop_args(frame, base - 1, n + 1);
                     push(new_undefined());
                     break;
                 }
-                auto func = JS_FUN(f.lock());
+                auto func = JS_FUN(f);
                 auto _this = new_object();
                 auto prototype = func->get("prototype");
                 if (!prototype || prototype->is_primitive())
@@ -1051,6 +1476,7 @@ namespace clib {
                 js_value::weak_ref t = _this;
                 auto r = 0;
                 auto ret = fast_api(func, t, args, jsv_function::at_new_function, &r);
+                drop_args(frame, base - 1, n + 1);
                 if (ret->is_primitive())
                     push(t);
                 else
@@ -1061,7 +1487,7 @@ namespace clib {
                 break;
             case LOAD_METHOD: {
                 auto n = code.op1;
-                auto key = current_stack->info->names.at(n);
+                auto key = n >= 0 ? current_stack->info->names.at(n) : pop().lock()->to_string(this, 0);
                 auto obj = top();
                 if (obj.lock()->get_type() == r_object || obj.lock()->get_type() == r_function) {
                     const auto &o = JS_OBJ(obj.lock());
@@ -1101,28 +1527,44 @@ namespace clib {
                     push(new_undefined()); // type error
             }
                 break;
-            case CALL_METHOD: {
+            case CALL_METHOD:
+            case CALL_METHOD_BUILTIN: {
                 auto n = code.op1;
                 if (n == -1) {
                     assert(!current_stack->rests.empty());
                     n = (int) current_stack->stack.size() - current_stack->rests.back();
                     current_stack->rests.pop_back();
                 }
-                assert((int) current_stack->stack.size() > n);
-                std::vector<js_value::weak_ref> args(n);
-                auto m = n;
-                while (m-- > 0) {
-                    args[m] = pop();
-                }
-                auto f = pop();
-                auto _this = pop().lock();
-                if (f.lock()->get_type() != r_function) {
+                assert((int) current_stack->stack.size() > n + 1);
+                auto frame = current_stack.get();
+                size_t base;
+                auto args = call_window(n, base);
+                auto f = frame->stack[base - 1].lock();
+                if (f->get_type() != r_function) {
+                    if (code.code == CALL_METHOD_BUILTIN)
+                        deopt(code);
+                    drop_args(frame, base - 2, n + 2);
                     push(new_undefined());
                     break;
                 }
-                auto func = JS_FUN(f.lock());
-                js_value::weak_ref t = _this;
+                auto func = JS_FUN(f);
+                js_value::weak_ref t = frame->stack[base - 2];
+#if QUICKEN
+                if (code.code == CALL_METHOD_BUILTIN) {
+                    if (func->builtin) {
+                        auto r = func->builtin(current_stack, t, args, *this, 0U);
+                        drop_args(frame, base - 2, n + 2);
+                        if (r != 0)
+                            return r;
+                        break;
+                    }
+                    deopt(code);
+                } else if (func->builtin && code.op1 >= 0 && observe(code)) {
+                    code.code = CALL_METHOD_BUILTIN;
+                }
+#endif
                 auto r = call_api(func, t, args, jsv_function::at_fast);
+                drop_args(frame, base - 2, n + 2);
                 if (r != 0)
                     return r;
             }
@@ -1136,12 +1578,32 @@ namespace clib {
         return 0;
     }
 
-    js_value::ref cjsruntime::load_const(int op) {
-        auto v = current_stack->info->consts.at(op);
-        if (v)
-            return register_value(v);
-        assert(!"invalid runtime type");
-        return permanents._undefined;
+    cjs_feedback &cjsruntime::feedback(const cjs_code &code) {
+        auto &info = *current_stack->info;
+        if (info.feedback.empty())
+            info.feedback.resize(info.codes.size());
+        return info.feedback.at(&code - info.codes.data());
+    }
+
+    bool cjsruntime::observe(cjs_code &code) {
+        auto &fb = feedback(code);
+        if (fb.deopts >= QUICKEN_DEOPT_LIMIT || ++fb.hits < QUICKEN_THRESHOLD)
+            return false;
+        fb.hits = 0;
+        fb.code = code.code;
+        return true;
+    }
+
+    void cjsruntime::deopt(cjs_code &code) {
+        auto &fb = feedback(code);
+        code.code = fb.code;
+        fb.deopts++;
+    }
+
+    const js_value::ref &cjsruntime::load_const(int op) {
+        const auto &v = current_stack->info->consts.at(op);
+        assert(v);
+        return v;
     }
 
     js_value::ref cjsruntime::load_fast(int op) {
@@ -1165,6 +1627,27 @@ namespace clib {
         return permanents._undefined;
     }
 
+    js_value::ref cjsruntime::load_attr(const js_value::ref &obj, const std::string &key) {
+        if (!obj->is_primitive()) {
+            auto o = JS_O(obj);
+            if (o->frames && key == "stack")
+                load_stack(o);
+            auto value = o->get(key);
+            if (value)
+                return value;
+        }
+        return permanents._undefined;
+    }
+
+    void cjsruntime::load_stack(const jsv_object::ref &obj) {
+        // 错误对象的stack在首次读取或枚举属性时才格式化
+        if (!obj->frames)
+            return;
+        if (obj->obj.find("stack") == obj->obj.end())
+            obj->obj["stack"] = new_string(format_stacktrace(*obj->frames));
+        obj->frames = nullptr;
+    }
+
     js_value::ref cjsruntime::load_global(int op) {
         auto g = current_stack->info->globals.at(op);
         auto &obj = stack.front()->envs.lock()->obj;
@@ -1237,6 +1720,20 @@ namespace clib {
         return p;
     }
 
+    cjs_args cjsruntime::call_window(int n, size_t &base) {
+        // 参数留在调用者栈上，调用返回后由drop_args移除
+        auto &s = current_stack->stack;
+        base = s.size() - n;
+        return cjs_args(s, base, n);
+    }
+
+    void cjsruntime::drop_args(cjs_function *frame, size_t from, size_t count) {
+        auto &s = frame->stack;
+        if (s.size() < from + count)
+            return;
+        s.erase(s.begin() + from, s.begin() + from + count);
+    }
+
     js_value::ref cjsruntime::register_value(const js_value::ref &value) {
         if (value)
             objs.push_back(value);
@@ -1253,7 +1750,7 @@ namespace clib {
         for (auto s = stack.rbegin(); s != stack.rend(); s++) {
             fprintf(stdout, "**** Stack [%p] \"%.100s\" '%.100s'\n",
                     s->get(), (*s)->name.c_str(),
-                    (*s)->info ? (*s)->info->text.c_str() : "[builtin]");
+                    (*s)->info ? (*s)->info->get_text().c_str() : "[builtin]");
             const auto &st = (*s)->stack;
             auto sti = (int) st.size();
             fprintf(stdout, "this | [%p] \n", (*s)->_this.lock().get());
@@ -1430,6 +1927,18 @@ namespace clib {
     jsv_object::ref cjsruntime::new_error(int type) {
         auto err = new_object();
         switch (type) {
+            case ERROR_ReferenceError:
+                err->__proto__ = permanents._proto_reference_error;
+                break;
+            case ERROR_SyntaxError:
+                err->__proto__ = permanents._proto_syntax_error;
+                break;
+            case ERROR_RangeError:
+                err->__proto__ = permanents._proto_range_error;
+                break;
+            case ERROR_TypeError:
+                err->__proto__ = permanents._proto_type_error;
+                break;
             default:
                 err->__proto__ = permanents._proto_error;
                 break;
@@ -1437,29 +1946,98 @@ namespace clib {
         return err;
     }
 
+    int cjsruntime::throw_error(int type, const std::string &message) {
+        auto err = new_error(type);
+        err->obj["message"] = new_string(message);
+        err->frames = get_stackframes();
+        get_try()->obj = err;
+        return 9;
+    }
+
+    int cjsruntime::eval_error(int type, const std::string &message, const std::string &name, bool top) {
+        if (!top && !stack.empty())
+            return throw_error(type, message);
+        while (!stack.empty()) {
+            delete_stack(stack.back());
+            stack.pop_back();
+        }
+        // 没有运行中的栈帧，建一个空的入口帧来报告错误
+        auto code = std::make_shared<sym_code_t>();
+        code->debugName = name;
+        auto top_stack = new_stack(std::make_shared<cjs_function_info>(code, *this));
+        top_stack->envs = permanents.global_env;
+        top_stack->_this = permanents.global_env;
+        stack.push_back(top_stack);
+        current_stack = stack.back();
+        auto err = new_error(type);
+        err->obj["message"] = new_string(message);
+        err->frames = get_stackframes();
+        write(OUTPUT_STDERR, "Uncaught ");
+        write(OUTPUT_STDERR, err->to_string(this, 1));
+        write(OUTPUT_STDERR, '\n');
+        if (auto_loop) {
+            run_until_idle();
+            delete_stack(current_stack);
+            stack.pop_back();
+        } else {
+            run_microtasks();
+        }
+        flush_output();
+        return 0;
+    }
+
     int cjsruntime::exec(const std::string &n, const std::string &s) {
         return ((cjs *) pjs)->exec(n, s, false);
     }
 
+    int cjsruntime::exec(const std::string &n, const cjs_source::ref &s) {
+        return ((cjs *) pjs)->exec(n, s, false);
+    }
+
     std::string cjsruntime::get_stacktrace() const {
-        std::stringstream ss, sx;
-        auto j = stack.size();
-        std::regex r(R"(\(([^:]+):\d+:\d+\)(.*))");
+        return format_stacktrace(*get_stackframes());
+    }
+
+    cjs_stack_frames cjsruntime::get_stackframes() const {
+        auto frames = std::make_shared<std::vector<cjs_stack_frame>>();
+        frames->reserve(stack.size());
         for (auto i = stack.rbegin(); i != stack.rend(); i++) {
-            ss << j-- << ": ";
-            if ((*i)->pc < (*i)->info->codes.size()) {
-                sx.str("");
-                const auto &c = (*i)->info->codes[(*i)->pc];
-                sx << "($1:" << c.line << ":" << c.column << ")$2";
-                ss << std::regex_replace((*i)->name, r, sx.str());
+            auto pc = (*i)->pc;
+            if ((*i)->reg) {
+                const auto &rcodes = (*i)->info->rcodes;
+                pc = pc < (int) rcodes.size() ? rcodes[pc].src : (int) (*i)->info->codes.size();
+            }
+            frames->push_back({(*i)->info, pc});
+        }
+        return frames;
+    }
+
+    std::string cjsruntime::format_stacktrace(const std::vector<cjs_stack_frame> &frames) {
+        std::string s;
+        auto j = frames.size();
+        for (const auto &f : frames) {
+            s += std::to_string(j--);
+            s += ": ";
+            if (!f.info) {
+                s += "(builtin)\n";
+                continue;
+            }
+            const auto &info = *f.info;
+            if (!info.debugFile.empty() && f.pc < (int) info.codes.size()) {
+                const auto &c = info.codes[f.pc];
+                s += "(";
+                s += info.debugFile;
+                s += ":";
+                s += std::to_string(c.line);
+                s += ":";
+                s += std::to_string(c.column);
+                s += ") ";
+                s += info.debugLabel;
             } else {
-                ss << (*i)->name;
+                s += info.debugName;
             }
-            if (!(*i)->info)
-                ss << " (builtin)";
-            ss << std::endl;
+            s += '\n';
         }
-        auto s = ss.str();
         if (!s.empty())
             s.pop_back();
         return s;
@@ -1472,18 +2050,20 @@ namespace clib {
         return true;
     }
 
-    static bool check_file(const std::string &filename, std::string &content) {
-        std::ifstream file(filename);
-        if (file) {
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            content = buffer.str();
-            return true;
-        }
-        return false;
+    void cjsruntime::set_const(const js_value::ref &value) {
+        // 常量常驻，不经过GC
+        if (value->attr & js_value::at_const)
+            return;
+        value->attr |= js_value::at_const;
+        permanents.refs.push_back(value);
     }
 
-    bool cjsruntime::get_file(std::string &filename, std::string &content) const {
+    static bool check_file(const std::string &filename, cjs_source::ref &content) {
+        content = cjs_source::from_file(filename);
+        return content != nullptr;
+    }
+
+    bool cjsruntime::get_file(std::string &filename, cjs_source::ref &content) const {
         if (filename.empty())
             return false;
         if (check_file(paths.back() + filename, content)) {
@@ -1611,7 +2191,8 @@ namespace clib {
         if (reuse_stack.empty()) {
             auto st = std::make_shared<cjs_function>(code);
             st->envs = new_object();
-            st->_this = stack.front()->envs;
+            if (!stack.empty())
+                st->_this = stack.front()->envs;
             return st;
         } else {
             auto st = reuse_stack.back();
@@ -1659,6 +2240,14 @@ namespace clib {
                 s2.lock()->mark(6);
             }
         }
+        for (const auto &q : {&microtasks, &macrotasks}) {
+            for (const auto &s : *q) {
+                s.func->mark(5);
+                for (const auto &s2 : s.args) {
+                    s2.lock()->mark(6);
+                }
+            }
+        }
 #if DUMP_STEP && DUMP_GC
         dump_step3();
 #endif
@@ -1765,8 +2354,20 @@ namespace clib {
         return s;
     }
 
+    js_value::ref cjsruntime::binop_top(int code, int *r) {
+        // 操作数在binop返回前一直留在栈上，嵌套调用中的gc不会回收它们
+        auto &st = current_stack->stack;
+        assert(st.size() >= 2);
+        auto ret = binop(code, st[st.size() - 2].lock(), st[st.size() - 1].lock(), r);
+        pop();
+        pop();
+        return ret;
+    }
+
     js_value::ref cjsruntime::binop(int code, const js_value::ref &_op1, const js_value::ref &_op2, int *r) {
         assert(r);
+        if (_op1->get_type() == r_number && _op2->get_type() == r_number && code != BINARY_FLOOR_DIVIDE)
+            return binop_number(code, JS_NUM(_op1), JS_NUM(_op2));
         auto conv = js_value::conv_number;
         switch (code) {
             case COMPARE_EQUAL:
@@ -1794,7 +2395,13 @@ namespace clib {
         }
         auto op1 = _op1->to_primitive(*this, js_value::conv_default, r);
         assert(op1);
+        // op2的转换可能调用脚本并触发gc，期间op1留在栈上
+        auto root = !_op2->is_primitive();
+        if (root)
+            push(op1);
         auto op2 = _op2->to_primitive(*this, js_value::conv_default, r);
+        if (root)
+            pop();
         assert(op2);
         if (code == BINARY_ADD) {
             if (op1->get_type() == r_string || op2->get_type() == r_string)
@@ -1831,24 +2438,7 @@ namespace clib {
                     break;
             }
         } else {
-            double s1, s2;
             switch (code) {
-                case COMPARE_LESS:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_boolean(s1 < s2);
-                case COMPARE_LESS_EQUAL:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_boolean(s1 <= s2);
-                case COMPARE_GREATER:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_boolean(s1 > s2);
-                case COMPARE_GREATER_EQUAL:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_boolean(s1 >= s2);
                 case COMPARE_EQUAL: {
                     if (op1->get_type() != op2->get_type()) {
                         if (op1->get_type() == r_null) {
@@ -1913,100 +2503,98 @@ namespace clib {
                             return new_boolean(op1 != op2);
                     }
                 }
-                case BINARY_POWER:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    if (s2 == 0)
-                        return new_number(1.0);
-                    if ((s1 == 1.0 || s1 == -1.0) && std::isinf(s2))
-                        return new_number(NAN);
-                    return new_number(pow(s1, s2));
-                case BINARY_MULTIPLY:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_number(s1 * s2);
-                case BINARY_MODULO:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    if (std::isinf(s1) || s2 == 0)
-                        return new_number(NAN);
-                    if (std::isinf(s2))
-                        return new_number(s1);
-                    if (s1 == 0)
-                        return new_number(std::isnan(s2) ? NAN : s1);
-                    return new_number(fmod(s1, s2));
-                case BINARY_ADD:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_number(s1 + s2);
-                case BINARY_SUBTRACT:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_number(s1 - s2);
-                case BINARY_TRUE_DIVIDE:
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    return new_number(s1 / s2);
-                case BINARY_LSHIFT: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    if (s2 == 0.0)
-                        return new_number(fix(s1) == 0.0 ? 0.0 : fix(s1));
-                    auto a = int(fix(s1));
-                    auto b = fix(s2);
-                    auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
-                    return new_number(double(int(a << c)));
-                }
-                case BINARY_RSHIFT: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    if (s2 == 0.0)
-                        return new_number(fix(s1) == 0.0 ? 0.0 : fix(s1));
-                    auto a = int(fix(s1));
-                    auto b = fix(s2);
-                    auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
-                    return new_number(double(int(a >> c)));
-                }
-                case BINARY_URSHIFT: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    if (s2 == 0.0)
-                        return new_number(fix(s1) == 0.0 ? 0.0 : uint32_t(fix(s1)));
-                    auto a = uint32_t(fix(s1));
-                    auto b = fix(s2);
-                    auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
-                    return new_number(double(uint32_t(a >> c)));
-                }
-                case BINARY_AND: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    auto a = uint32_t(fix(s1));
-                    auto b = uint32_t(fix(s2));
-                    return new_number(double(int(a & b)));
-                }
-                case BINARY_XOR: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    auto a = uint32_t(fix(s1));
-                    auto b = uint32_t(fix(s2));
-                    return new_number(double(int(a ^ b)));
-                }
-                case BINARY_OR: {
-                    s1 = op1->to_number(this);
-                    s2 = op2->to_number(this);
-                    auto a = uint32_t(fix(s1));
-                    auto b = uint32_t(fix(s2));
-                    return new_number(double(int(a | b)));
-                }
                 default:
-                    assert(!"invalid binop type");
-                    break;
+                    return binop_number(code, op1->to_number(this), op2->to_number(this));
             }
         }
         assert(!"invalid binop type");
         return new_number(NAN);
     }
 
+    js_value::ref cjsruntime::binop_number(int code, double s1, double s2) {
+        switch (code) {
+            case COMPARE_LESS:
+                return new_boolean(s1 < s2);
+            case COMPARE_LESS_EQUAL:
+                return new_boolean(s1 <= s2);
+            case COMPARE_GREATER:
+                return new_boolean(s1 > s2);
+            case COMPARE_GREATER_EQUAL:
+                return new_boolean(s1 >= s2);
+            case COMPARE_EQUAL:
+            case COMPARE_FEQUAL:
+                return new_boolean(s1 == s2);
+            case COMPARE_NOT_EQUAL:
+            case COMPARE_FNOT_EQUAL:
+                return new_boolean(s1 != s2);
+            case BINARY_POWER:
+                if (s2 == 0)
+                    return new_number(1.0);
+                if ((s1 == 1.0 || s1 == -1.0) && std::isinf(s2))
+                    return new_number(NAN);
+                return new_number(pow(s1, s2));
+            case BINARY_MULTIPLY:
+                return new_number(s1 * s2);
+            case BINARY_MODULO:
+                if (std::isinf(s1) || s2 == 0)
+                    return new_number(NAN);
+                if (std::isinf(s2))
+                    return new_number(s1);
+                if (s1 == 0)
+                    return new_number(std::isnan(s2) ? NAN : s1);
+                return new_number(fmod(s1, s2));
+            case BINARY_ADD:
+                return new_number(s1 + s2);
+            case BINARY_SUBTRACT:
+                return new_number(s1 - s2);
+            case BINARY_TRUE_DIVIDE:
+                return new_number(s1 / s2);
+            case BINARY_LSHIFT: {
+                if (s2 == 0.0)
+                    return new_number(fix(s1) == 0.0 ? 0.0 : fix(s1));
+                auto a = int(fix(s1));
+                auto b = fix(s2);
+                auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
+                return new_number(double(int(a << c)));
+            }
+            case BINARY_RSHIFT: {
+                if (s2 == 0.0)
+                    return new_number(fix(s1) == 0.0 ? 0.0 : fix(s1));
+                auto a = int(fix(s1));
+                auto b = fix(s2);
+                auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
+                return new_number(double(int(a >> c)));
+            }
+            case BINARY_URSHIFT: {
+                if (s2 == 0.0)
+                    return new_number(fix(s1) == 0.0 ? 0.0 : uint32_t(fix(s1)));
+                auto a = uint32_t(fix(s1));
+                auto b = fix(s2);
+                auto c = b > 0 ? (uint32_t(b) % 32) : uint32_t(int(fmod(b, 32)) + 32);
+                return new_number(double(uint32_t(a >> c)));
+            }
+            case BINARY_AND: {
+                auto a = uint32_t(fix(s1));
+                auto b = uint32_t(fix(s2));
+                return new_number(double(int(a & b)));
+            }
+            case BINARY_XOR: {
+                auto a = uint32_t(fix(s1));
+                auto b = uint32_t(fix(s2));
+                return new_number(double(int(a ^ b)));
+            }
+            case BINARY_OR: {
+                auto a = uint32_t(fix(s1));
+                auto b = uint32_t(fix(s2));
+                return new_number(double(int(a | b)));
+            }
+            default:
+                assert(!"invalid binop type");
+                break;
+        }
+        return new_number(NAN);
+    }
+
     void cjsruntime::print(const js_value::ref &value, int level, std::ostream &os) {
         if (value == nullptr) {
             os << "undefined" << std::endl;
@@ -2045,6 +2633,12 @@ namespace clib {
                         os << s.first << ": " << std::endl;
                         print(s.second.lock(), level + 1, os);
                     }
+                    if (n->frames) {
+                        os << std::setfill(' ') << std::setw(level) << "";
+                        os << "stack: " << std::endl;
+                        os << std::setfill(' ') << std::setw(level + 1) << "";
+                        os << "string: " << format_stacktrace(*n->frames) << std::endl;
+                    }
                 }
             }
                 break;
@@ -2054,7 +2648,7 @@ namespace clib {
                     os << "function: builtin " << n->name << std::endl;
                 else if (n->code) {
                     os << "function: " << n->code->debugName << " ";
-                    os << n->code->text << std::endl;;
+                    os << n->code->get_text() << std::endl;;
                     if (n->closure.lock()) {
                         print(n->closure.lock(), level + 1, os);
                     }
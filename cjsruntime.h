@@ -6,10 +6,16 @@
 #ifndef CLIBJS_CJSRUNTIME_H
 #define CLIBJS_CJSRUNTIME_H
 
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
 #include <functional>
+#include <stdexcept>
 #include <chrono>
 #include <list>
 #include <map>
+#include <deque>
+#include <set>
 #include "cjsgen.h"
 
 #define ROOT_DIR "./"
@@ -18,7 +24,7 @@
 #define JS_NUM(op) (std::dynamic_pointer_cast<jsv_number>(op)->number)
 #define JS_STR(op) (std::dynamic_pointer_cast<jsv_string>(op)->str)
 #define JS_STR2NUM(op, d) std::dynamic_pointer_cast<jsv_string>(op)->to_number(d)
-#define JS_STRF(op) (std::dynamic_pointer_cast<jsv_function>(op)->code->text)
+#define JS_STRF(op) (std::dynamic_pointer_cast<jsv_function>(op)->code->get_text())
 #define JS_OBJ(op) (std::dynamic_pointer_cast<jsv_object>(op)->obj)
 #define JS_O(op) (std::dynamic_pointer_cast<jsv_object>(op))
 #define JS_FUN(op) (std::dynamic_pointer_cast<jsv_function>(op))
@@ -50,6 +56,47 @@ namespace clib {
 
     class cjs_function_info;
 
+    struct cjs_stack_frame {
+        std::shared_ptr<cjs_function_info> info;
+        int pc{0};
+    };
+
+    using cjs_stack_frames = std::shared_ptr<std::vector<cjs_stack_frame>>;
+
+    // 参数视图：引用调用者操作数栈上连续的一段参数，不拷贝也不持有
+    // 保存栈和偏移而不是裸指针，被调用者往调用者栈上压入结果导致重新分配时仍然有效
+    // begin/end返回裸指针，只能在不回调脚本的范围内使用
+    class cjs_args {
+    public:
+        using value_type = std::weak_ptr<js_value>;
+        cjs_args() = default;
+        cjs_args(std::vector<value_type> &v) : vec(&v), len(v.size()) {}
+        cjs_args(std::vector<value_type> &v, size_t pos, size_t n) : vec(&v), off(pos), len(n) {
+            assert(pos + n <= v.size());
+        }
+        size_t size() const { return len; }
+        bool empty() const { return len == 0; }
+        value_type &operator[](size_t i) const {
+            assert(i < len && off + len <= vec->size());
+            return (*vec)[off + i];
+        }
+        value_type &at(size_t i) const {
+            if (i >= len)
+                throw std::out_of_range("cjs_args");
+            return (*this)[i];
+        }
+        value_type &front() const { return (*this)[0]; }
+        value_type &back() const { return (*this)[len - 1]; }
+        value_type *begin() const { return vec ? vec->data() + off : nullptr; }
+        value_type *end() const { return vec ? vec->data() + off + len : nullptr; }
+        cjs_args sub(size_t pos) const { return pos < len ? cjs_args(*vec, off + pos, len - pos) : cjs_args(); }
+
+    private:
+        std::vector<value_type> *vec{nullptr};
+        size_t off{0};
+        size_t len{0};
+    };
+
     class js_value_new {
     public:
         virtual std::shared_ptr<jsv_number> new_number(double n) = 0;
@@ -63,23 +110,41 @@ namespace clib {
         virtual std::shared_ptr<cjs_function> new_func(const std::shared_ptr<cjs_function_info> &code) = 0;
         virtual std::shared_ptr<jsv_object> new_array() = 0;
         virtual std::shared_ptr<jsv_object> new_error(int) = 0;
+        virtual int throw_error(int, const std::string &) = 0;
         virtual int exec(const std::string &, const std::string &) = 0;
+        virtual int exec(const std::string &, const cjs_source::ref &) = 0;
         virtual std::string get_stacktrace() const = 0;
+        virtual cjs_stack_frames get_stackframes() const = 0;
         virtual bool set_builtin(const std::shared_ptr<jsv_object> &obj) = 0;
-        virtual bool get_file(std::string &filename, std::string &content) const = 0;
+        virtual void set_const(const std::shared_ptr<js_value> &value) = 0;
+        virtual bool get_file(std::string &filename, cjs_source::ref &content) const = 0;
+        enum error_t {
+            ERROR_Error,
+            ERROR_ReferenceError,
+            ERROR_SyntaxError,
+            ERROR_RangeError,
+            ERROR_TypeError,
+        };
         enum api {
             API_none,
             API_setTimeout,
             API_setInterval,
             API_clearTimeout,
             API_clearInterval,
+            API_queueMicrotask,
         };
-        virtual int call_api(int, std::weak_ptr<js_value> &,
-                             std::vector<std::weak_ptr<js_value>> &, uint32_t) = 0;
+        virtual int call_api(int, std::weak_ptr<js_value> &, cjs_args, uint32_t) = 0;
         virtual int call_api(const std::shared_ptr<jsv_function> &, std::weak_ptr<js_value> &,
-                             std::vector<std::weak_ptr<js_value>> &, uint32_t) = 0;
+                             cjs_args, uint32_t) = 0;
         virtual std::shared_ptr<js_value> fast_api(const std::shared_ptr<jsv_function> &, std::weak_ptr<js_value> &,
-                                                   std::vector<std::weak_ptr<js_value>> &, uint32_t, int * = nullptr) = 0;
+                                                   cjs_args, uint32_t, int * = nullptr) = 0;
+        enum output_t {
+            OUTPUT_STDOUT,
+            OUTPUT_STDERR,
+            OUTPUT_END,
+        };
+        virtual void write(output_t, const std::string &) = 0;
+        virtual void write(output_t, char) = 0;
     };
 
     class js_value : public std::enable_shared_from_this<js_value> {
@@ -183,6 +248,7 @@ namespace clib {
         ref clear();
         std::unordered_map<std::string, js_value::weak_ref> obj;
         std::unordered_map<std::string, js_value::weak_ref> special;
+        cjs_stack_frames frames;
     };
 
     class jsv_null : public js_value {
@@ -233,22 +299,63 @@ namespace clib {
         double to_number(js_value_new *n) const override;
         ref clear2();
         std::shared_ptr<cjs_function_info> code;
-        std::function<int(std::shared_ptr<cjs_function> &, js_value::weak_ref &_this, std::vector<js_value::weak_ref> &, js_value_new &, uint32_t attr)> builtin;
+        std::function<int(std::shared_ptr<cjs_function> &, js_value::weak_ref &_this, cjs_args &, js_value_new &, uint32_t attr)> builtin;
         jsv_object::weak_ref closure;
         std::string name;
     };
 
+    struct cjs_jit_code;
+
+    // 指令的类型反馈：命中次数达到阈值后改写为特化指令，code保存原始指令
+    struct cjs_feedback {
+        int code{0};
+        uint8_t hits{0};
+        uint8_t deopts{0};
+    };
+
+    // 寄存器字节码：三地址指令，操作数为帧内临时槽、局部变量或常量
+    enum reg_ins_t {
+        R_MOV,
+        R_LOADX,
+        R_GETATTR,
+        R_BINOP,
+        R_UNOP,
+        R_INC,
+        R_JMP,
+        R_JF,
+        R_JT,
+        R_CMPJF,
+        R_RET,
+        R_PUSH,
+        R_POP,
+        R_STACK,
+    };
+
+#define REG_CONST (1 << 28) // 操作数>=REG_CONST为常量，<0为局部变量，其余为临时槽
+#define REG_NONE INT32_MIN
+
+    struct cjs_reg_code {
+        int code, op, dst, a, b;
+        int src; // 对应的栈式指令，用于调用栈信息
+    };
+
     class cjs_function_info : public std::enable_shared_from_this<cjs_function_info> {
     public:
         using ref = std::shared_ptr<cjs_function_info>;
         using weak_ref = std::weak_ptr<cjs_function_info>;
-        explicit cjs_function_info(const sym_code_t::ref &code, js_value_new &n);
+        explicit cjs_function_info(const sym_code_t::ref &code, js_value_new &n, bool lazy = false);
+        void load(js_value_new &n);
         static js_value::ref load_const(const cjs_consts &c, int op, js_value_new &n);
+        std::string get_text() const;
         bool arrow{false};
         std::string debugName;
+        std::string debugFile;
+        std::string debugLabel;
         std::string simpleName;
         std::string fullName;
-        std::string text;
+        cjs_source::ref source;
+        int start{0};
+        int end{0};
         int args_num{0};
         bool rest{false};
         std::vector<std::string> args;
@@ -258,6 +365,15 @@ namespace clib {
         std::vector<js_value::ref> consts;
         std::vector<cjs_code> codes;
         std::vector<std::string> closure;
+        sym_code_t::ref pending; // 函数体在首次调用时才装载
+        bool load_reg();
+        int reg_state{0}; // 0: 未转换，1: 可用，-1: 不支持
+        int reg_size{0};
+        std::vector<cjs_reg_code> rcodes;
+        std::vector<cjs_feedback> feedback;
+        int hotness{0}; // 调用次数与循环回边次数
+        int jit_state{0}; // 0: 未编译，1: 已编译，-1: 不支持
+        std::shared_ptr<cjs_jit_code> jit;
     };
 
     struct sym_try_t {
@@ -291,6 +407,8 @@ namespace clib {
         jsv_object::weak_ref closure;
         std::vector<int> rests;
         std::vector<sym_try_t::ref> _try;
+        bool reg{false};
+        std::vector<js_value::weak_ref *> slots;
     };
 
     struct cjs_runtime_reuse {
@@ -301,10 +419,34 @@ namespace clib {
         std::vector<jsv_function::ref> reuse_functions;
     };
 
+    class cjsruntime;
+
+    // 基线JIT：把字节码逐条翻译成x86-64机器码，由机器码调用运行时的辅助函数
+    class cjsjit {
+    public:
+        static bool compile(cjs_function_info &info);
+        static int call(cjsruntime &rt);
+
+    private:
+        static int run(cjsruntime *rt, cjs_code *code);
+        static void load_const(cjsruntime *rt, cjs_code *code);
+        static void load_fast(cjsruntime *rt, cjs_code *code);
+        static void load_fast_fast(cjsruntime *rt, cjs_code *code);
+        static void store_fast(cjsruntime *rt, cjs_code *code);
+        static void store_fast_pop(cjsruntime *rt, cjs_code *code);
+        static void pop_top(cjsruntime *rt, cjs_code *code);
+        static void dup_top(cjsruntime *rt, cjs_code *code);
+        static int test(cjsruntime *rt, cjs_code *code);
+        static int compare(cjsruntime *rt, cjs_code *code);
+        static int binary(cjsruntime *rt, cjs_code *code);
+        static void tick(cjsruntime *rt);
+    };
+
     class cjsruntime : public js_value_new {
+        friend class cjsjit;
     public:
         cjsruntime() = default;
-        ~cjsruntime() = default;
+        ~cjsruntime();
 
         cjsruntime(const cjsruntime &) = delete;
         cjsruntime &operator=(const cjsruntime &) = delete;
@@ -312,7 +454,19 @@ namespace clib {
         void init(void *);
 
         int eval(cjs_code_result::ref code, const std::string &_path, bool top);
+        int eval(const cjs_function_info::ref &info, const std::string &_path, bool top);
+        cjs_function_info::ref load(const cjs_code_result::ref &code);
+        js_value::ref get_global(const std::string &name) const;
+        int call(const cjs_function_info::ref &base, const jsv_function::ref &func,
+                 std::vector<js_value::weak_ref> &args, js_value::ref &ret);
         void set_readonly(bool);
+        void set_auto_loop(bool);
+        bool run_one_task();
+        void run_until_idle();
+        void set_register_vm(bool);
+        void set_jit(bool enable, bool force);
+        void set_max_depth(size_t depth);
+        uint64_t get_steps() const;
 
         jsv_number::ref new_number(double n) override;
         jsv_string::ref new_string(const std::string &s) override;
@@ -325,32 +479,59 @@ namespace clib {
         cjs_function::ref new_func(const cjs_function_info::ref &code) override;
         jsv_object::ref new_array() override;
         jsv_object::ref new_error(int) override;
+        int throw_error(int, const std::string &) override;
+        int eval_error(int type, const std::string &message, const std::string &name, bool top);
         int exec(const std::string &, const std::string &) override;
+        int exec(const std::string &, const cjs_source::ref &) override;
         std::string get_stacktrace() const override;
+        cjs_stack_frames get_stackframes() const override;
+        static std::string format_stacktrace(const std::vector<cjs_stack_frame> &frames);
         bool set_builtin(const std::shared_ptr<jsv_object> &obj) override;
-        bool get_file(std::string &filename, std::string &content) const override;
+        void set_const(const js_value::ref &value) override;
+        bool get_file(std::string &filename, cjs_source::ref &content) const override;
         int call_internal(bool top, size_t stack_size);
-        int call_api(int type, js_value::weak_ref &_this,
-                     std::vector<js_value::weak_ref> &args, uint32_t attr) override;
-        int call_api(const jsv_function::ref &, js_value::weak_ref &_this, std::vector<js_value::weak_ref> &, uint32_t attr) override;
+        int call_api(int type, js_value::weak_ref &_this, cjs_args args, uint32_t attr) override;
+        int call_api(const jsv_function::ref &, js_value::weak_ref &_this, cjs_args, uint32_t attr) override;
         js_value::ref fast_api(const jsv_function::ref &, js_value::weak_ref &_this,
-                               std::vector<js_value::weak_ref> &args, uint32_t attr, int * = nullptr) override;
+                               cjs_args args, uint32_t attr, int * = nullptr) override;
 
         static bool to_number(const js_value::ref &, double &);
         static std::vector<js_value::weak_ref> to_array(const js_value::ref &);
 
+        enum flush_policy_t {
+            FLUSH_AUTO,
+            FLUSH_LINE,
+            FLUSH_BLOCK,
+            FLUSH_ALWAYS,
+        };
+        void write(output_t, const std::string &) override;
+        void write(output_t, char) override;
+        void set_flush_policy(output_t, flush_policy_t);
+        void flush_output();
+
     private:
-        int run(const cjs_code &code);
-        js_value::ref load_const(int op);
+        int run(cjs_code &code);
+        int run_reg(const cjs_reg_code &code);
+        cjs_feedback &feedback(const cjs_code &code);
+        bool observe(cjs_code &code);
+        void deopt(cjs_code &code);
+        js_value::weak_ref *reg_slot(int op);
+        js_value::ref reg_get(int op);
+        void reg_set(int op, const js_value::ref &value);
+        const js_value::ref &load_const(int op);
         js_value::ref load_fast(int op);
         js_value::ref load_name(int op);
         js_value::ref load_global(int op);
+        js_value::ref load_attr(const js_value::ref &obj, const std::string &key);
+        void load_stack(const jsv_object::ref &obj);
         bool remove_global(int op);
         js_value::ref load_closure(const std::string &name);
         js_value::ref load_deref(const std::string &name);
         void push(js_value::weak_ref value);
         const js_value::weak_ref &top() const;
         js_value::weak_ref pop();
+        cjs_args call_window(int n, size_t &base);
+        static void drop_args(cjs_function *frame, size_t from, size_t count);
 
         js_value::ref register_value(const js_value::ref &value);
         void dump_step(const cjs_code &code) const;
@@ -375,17 +556,33 @@ namespace clib {
         static void print(const js_value::ref &value, int level, std::ostream &os);
 
         js_value::ref binop(int code, const js_value::ref &op1, const js_value::ref &op2, int *);
+        js_value::ref binop_top(int code, int *r);
+        js_value::ref binop_number(int code, double s1, double s2);
 
-        void eval_timeout();
+        void run_microtasks();
+        bool pop_task();
+
+        void flush_output(output_t);
+        void flush_others(output_t);
 
         double api_setTimeout(int time, const jsv_function::ref &func, std::vector<js_value::weak_ref> args, uint32_t attr, bool once);
         void api_clearTimeout(double id);
+        struct job_t;
+        int call_job(job_t &job);
+        int call_guarded(const jsv_function::ref &func, js_value::weak_ref &_this,
+                         cjs_args args, uint32_t attr, js_value::ref &ret);
 
         sym_try_t::ref get_try() const;
 
     private:
         void *pjs{nullptr};
         bool readonly{true};
+        bool register_vm{false};
+        uint64_t steps{0};
+        int jit_threshold{-1};
+        int jit_ticks{0};
+        size_t max_depth{0};
+        int native_depth{0};
         std::vector<cjs_function::ref> stack;
         cjs_function::ref current_stack;
         std::vector<cjs_function::ref> reuse_stack;
@@ -416,6 +613,7 @@ namespace clib {
             jsv_function::ref global_setInterval;
             jsv_function::ref global_clearTimeout;
             jsv_function::ref global_clearInterval;
+            jsv_function::ref global_queueMicrotask;
             // proto
             jsv_object::ref _proto_boolean;
             jsv_object::ref _proto_function;
@@ -448,22 +646,52 @@ namespace clib {
             // error
             jsv_object::ref _proto_error;
             jsv_function::ref f_error;
+            jsv_object::ref _proto_reference_error;
+            jsv_function::ref f_reference_error;
+            jsv_object::ref _proto_syntax_error;
+            jsv_function::ref f_syntax_error;
+            jsv_object::ref _proto_range_error;
+            jsv_function::ref f_range_error;
+            jsv_object::ref _proto_type_error;
+            jsv_function::ref f_type_error;
         } permanents;
         cjs_runtime_reuse reuse;
         struct timeout_t {
             bool once{true};
+            bool cleared{false};
             int time{0};
             uint32_t id{0};
+            std::chrono::steady_clock::time_point deadline;
             jsv_function::ref func;
             std::vector<js_value::weak_ref> args;
             uint32_t attr;
         };
+        struct job_t {
+            jsv_function::ref func;
+            std::vector<js_value::weak_ref> args;
+            uint32_t attr{0};
+            std::shared_ptr<timeout_t> timer;
+        };
+        struct timeout_cmp_t {
+            bool operator()(const std::shared_ptr<timeout_t> &a, const std::shared_ptr<timeout_t> &b) const {
+                return a->deadline == b->deadline ? a->id < b->id : a->deadline < b->deadline;
+            }
+        };
         struct timeout_struct {
-            std::time_t startup_time{std::chrono::system_clock::to_time_t(std::chrono::system_clock::now())};
             uint32_t global_id{0};
-            std::map<std::time_t, std::list<std::shared_ptr<timeout_t>>> queues;
+            // 按到期时间排序，clearTimeout可以直接删除
+            std::set<std::shared_ptr<timeout_t>, timeout_cmp_t> queues;
             std::unordered_map<uint32_t, std::shared_ptr<timeout_t>> ids;
         } timeout;
+        std::deque<job_t> microtasks;
+        std::deque<job_t> macrotasks;
+        bool auto_loop{true};
+        struct output_struct {
+            FILE *file{nullptr};
+            flush_policy_t policy{FLUSH_AUTO};
+            std::string buffer;
+        };
+        output_struct outputs[OUTPUT_END];
     };
 }
 
@@ -20,11 +20,18 @@
 
 #define LOG_AST 0
 #define LOG_FILE 0
+#define MAX_CALL_DEPTH 10000
 
 namespace clib {
 
     void cjsruntime::init(void *p) {
         pjs = p;
+        set_max_depth(MAX_CALL_DEPTH);
+        // output
+        outputs[OUTPUT_STDOUT].file = stdout;
+        outputs[OUTPUT_STDERR].file = stderr;
+        set_flush_policy(OUTPUT_STDOUT, FLUSH_AUTO);
+        set_flush_policy(OUTPUT_STDERR, FLUSH_AUTO);
         // proto
         permanents._proto_root = _new_object(js_value::at_const | js_value::at_readonly);
         permanents._proto_number = _new_object(js_value::at_const | js_value::at_readonly);
@@ -66,8 +73,9 @@ namespace clib {
                 func->stack.push_back(js.new_boolean(false));
                 return 0;
             }
-            const auto &obj = JS_OBJ(f);
-            func->stack.push_back(js.new_boolean(obj.find(args.front().lock()->to_string(&js, 0)) != obj.end()));
+            const auto &o = JS_O(f);
+            auto key = args.front().lock()->to_string(&js, 0);
+            func->stack.push_back(js.new_boolean(o->obj.find(key) != o->obj.end() || (o->frames && key == "stack")));
             return 0;
         };
         permanents._proto_object->obj.insert({permanents._proto_object_hasOwnProperty->name, permanents._proto_object_hasOwnProperty});
@@ -93,10 +101,7 @@ namespace clib {
             }
             auto fun = JS_FUN(f);
             auto __this = __args.empty() ? _this : __args.front();
-            auto args = __args.size() > 1 ?
-                        std::vector<js_value::weak_ref>(__args.begin() + 1, __args.end()) :
-                        std::vector<js_value::weak_ref>();
-            return js.call_api(fun, __this, args, jsv_function::at_fast);
+            return js.call_api(fun, __this, __args.sub(1), jsv_function::at_fast);
         };
         permanents._proto_function->obj.insert({permanents._proto_function_call->name, permanents._proto_function_call});
         permanents._proto_function_apply = _new_function(nullptr, js_value::at_const | js_value::at_readonly);
@@ -144,6 +149,7 @@ namespace clib {
 #endif
         permanents.global_env->obj.insert({"NaN", permanents.__nan});
         permanents.global_env->obj.insert({"Infinity", permanents._inf});
+        permanents.global_env->obj.insert({"undefined", permanents._undefined});
         // debug
         permanents._debug_dump = _new_function(nullptr, js_value::at_const | js_value::at_readonly);
         permanents._debug_dump->obj.insert({"length", _int_1});
@@ -175,15 +181,12 @@ namespace clib {
         permanents.console_log->obj.insert({"length", _int_1});
         permanents.console_log->name = "log";
         permanents.console_log->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
-            std::stringstream ss;
             for (size_t i = 0; i < args.size(); i++) {
-                ss << args[i].lock()->to_string(&js, 1);
+                js.write(js_value_new::OUTPUT_STDOUT, args[i].lock()->to_string(&js, 1));
                 if (i + 1 < args.size())
-                    ss << " ";
+                    js.write(js_value_new::OUTPUT_STDOUT, ' ');
             }
-            ss << std::endl;
-            auto s = ss.str();
-            std::cout << ss.str();
+            js.write(js_value_new::OUTPUT_STDOUT, '\n');
             func->stack.push_back(js.new_undefined());
             return 0;
         };
@@ -192,15 +195,12 @@ namespace clib {
         permanents.console_error->obj.insert({"length", _int_1});
         permanents.console_error->name = "error";
         permanents.console_error->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
-            std::stringstream ss;
             for (size_t i = 0; i < args.size(); i++) {
-                ss << args[i].lock()->to_string(&js, 1);
+                js.write(js_value_new::OUTPUT_STDERR, args[i].lock()->to_string(&js, 1));
                 if (i + 1 < args.size())
-                    ss << " ";
+                    js.write(js_value_new::OUTPUT_STDERR, ' ');
             }
-            ss << std::endl;
-            auto s = ss.str();
-            std::cerr << ss.str();
+            js.write(js_value_new::OUTPUT_STDERR, '\n');
             func->stack.push_back(js.new_undefined());
             return 0;
         };
@@ -225,10 +225,11 @@ namespace clib {
                 return 0;
             }
             auto filename = args.front().lock()->to_string(&js, 0);
-            std::string content;
+            cjs_source::ref content;
             if (js.get_file(filename, content)) {
                 func->pc++;
-                js.exec(filename, content);
+                if (js.exec(filename, content) == 9)
+                    return 9;
                 return 3;
             }
             func->stack.push_back(js.new_undefined());
@@ -402,6 +403,13 @@ namespace clib {
             return js.call_api(API_clearInterval, _this, args, 0);
         };
         permanents.global_env->obj.insert({permanents.global_clearInterval->name, permanents.global_clearInterval});
+        permanents.global_queueMicrotask = _new_function(nullptr, js_value::at_const | js_value::at_readonly);
+        permanents.global_queueMicrotask->obj.insert({"length", _int_1});
+        permanents.global_queueMicrotask->name = "queueMicrotask";
+        permanents.global_queueMicrotask->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
+            return js.call_api(API_queueMicrotask, _this, args, 0);
+        };
+        permanents.global_env->obj.insert({permanents.global_queueMicrotask->name, permanents.global_queueMicrotask});
         // error
         permanents._proto_error = _new_object(js_value::at_const | js_value::at_readonly);
         permanents._proto_error->obj["name"] =
@@ -415,10 +423,74 @@ namespace clib {
             if (!args.empty()) {
                 err->obj.insert({"message", js.new_string(args.front().lock()->to_string(&js, 0))});
             }
-            err->obj.insert({"stack", js.new_string(js.get_stacktrace())});
+            err->frames = js.get_stackframes();
             func->stack.push_back(err);
             return 0;
         };
         permanents.global_env->obj.insert({permanents.f_error->name, permanents.f_error});
+        permanents._proto_reference_error = _new_object(js_value::at_const | js_value::at_readonly);
+        permanents._proto_reference_error->__proto__ = permanents._proto_error;
+        permanents._proto_reference_error->obj["name"] = _new_string("ReferenceError", js_value::at_const | js_value::at_refs);
+        permanents.f_reference_error = _new_function(permanents._proto_reference_error, js_value::at_const | js_value::at_readonly);
+        permanents.f_reference_error->obj.insert({"length", _int_1});
+        permanents.f_reference_error->name = "ReferenceError";
+        permanents.f_reference_error->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
+            auto err = js.new_error(js_value_new::ERROR_ReferenceError);
+            if (!args.empty()) {
+                err->obj.insert({"message", js.new_string(args.front().lock()->to_string(&js, 0))});
+            }
+            err->frames = js.get_stackframes();
+            func->stack.push_back(err);
+            return 0;
+        };
+        permanents.global_env->obj.insert({permanents.f_reference_error->name, permanents.f_reference_error});
+        permanents._proto_syntax_error = _new_object(js_value::at_const | js_value::at_readonly);
+        permanents._proto_syntax_error->__proto__ = permanents._proto_error;
+        permanents._proto_syntax_error->obj["name"] = _new_string("SyntaxError", js_value::at_const | js_value::at_refs);
+        permanents.f_syntax_error = _new_function(permanents._proto_syntax_error, js_value::at_const | js_value::at_readonly);
+        permanents.f_syntax_error->obj.insert({"length", _int_1});
+        permanents.f_syntax_error->name = "SyntaxError";
+        permanents.f_syntax_error->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
+            auto err = js.new_error(js_value_new::ERROR_SyntaxError);
+            if (!args.empty()) {
+                err->obj.insert({"message", js.new_string(args.front().lock()->to_string(&js, 0))});
+            }
+            err->frames = js.get_stackframes();
+            func->stack.push_back(err);
+            return 0;
+        };
+        permanents.global_env->obj.insert({permanents.f_syntax_error->name, permanents.f_syntax_error});
+        permanents._proto_range_error = _new_object(js_value::at_const | js_value::at_readonly);
+        permanents._proto_range_error->__proto__ = permanents._proto_error;
+        permanents._proto_range_error->obj["name"] = _new_string("RangeError", js_value::at_const | js_value::at_refs);
+        permanents.f_range_error = _new_function(permanents._proto_range_error, js_value::at_const | js_value::at_readonly);
+        permanents.f_range_error->obj.insert({"length", _int_1});
+        permanents.f_range_error->name = "RangeError";
+        permanents.f_range_error->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
+            auto err = js.new_error(js_value_new::ERROR_RangeError);
+            if (!args.empty()) {
+                err->obj.insert({"message", js.new_string(args.front().lock()->to_string(&js, 0))});
+            }
+            err->frames = js.get_stackframes();
+            func->stack.push_back(err);
+            return 0;
+        };
+        permanents.global_env->obj.insert({permanents.f_range_error->name, permanents.f_range_error});
+        permanents._proto_type_error = _new_object(js_value::at_const | js_value::at_readonly);
+        permanents._proto_type_error->__proto__ = permanents._proto_error;
+        permanents._proto_type_error->obj["name"] = _new_string("TypeError", js_value::at_const | js_value::at_refs);
+        permanents.f_type_error = _new_function(permanents._proto_type_error, js_value::at_const | js_value::at_readonly);
+        permanents.f_type_error->obj.insert({"length", _int_1});
+        permanents.f_type_error->name = "TypeError";
+        permanents.f_type_error->builtin = [](auto &func, auto &_this, auto &args, auto &js, auto attr) {
+            auto err = js.new_error(js_value_new::ERROR_TypeError);
+            if (!args.empty()) {
+                err->obj.insert({"message", js.new_string(args.front().lock()->to_string(&js, 0))});
+            }
+            err->frames = js.get_stackframes();
+            func->stack.push_back(err);
+            return 0;
+        };
+        permanents.global_env->obj.insert({permanents.f_type_error->name, permanents.f_type_error});
     }
 }
\ No newline at end of file
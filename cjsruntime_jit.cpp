@@ -0,0 +1,364 @@
+//
+// Project: clibjs
+// Created by bajdcc
+//
+
+#include <cassert>
+#include <cstring>
+#include "cjsruntime.h"
+
+#if defined(CJS_JIT) && defined(__x86_64__) && defined(__linux__)
+#define JIT_X64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_X64 0
+#endif
+
+#define JIT_TICK_PERIOD 128
+
+namespace clib {
+
+    // 机器码入口：(运行时, &frame->pc, 指令地址表)，返回值同run
+    struct cjs_jit_code {
+        using entry_t = int (*)(cjsruntime *, int *, void **);
+        ~cjs_jit_code();
+        void *mem{nullptr};
+        size_t size{0};
+        entry_t entry{nullptr};
+        std::vector<void *> table;
+    };
+
+    cjs_jit_code::~cjs_jit_code() {
+#if JIT_X64
+        if (mem)
+            munmap(mem, size);
+#endif
+    }
+
+    int cjsjit::call(cjsruntime &rt) {
+        auto &f = *rt.current_stack;
+        auto &j = *f.info->jit;
+        if (f.pc >= (int) j.table.size() - 1)
+            return 4;
+        return j.entry(&rt, &f.pc, j.table.data());
+    }
+
+    int cjsjit::run(cjsruntime *rt, cjs_code *code) {
+        return rt->run(*code);
+    }
+
+    void cjsjit::load_const(cjsruntime *rt, cjs_code *code) {
+        rt->push(rt->load_const(code->op1));
+    }
+
+    void cjsjit::load_fast(cjsruntime *rt, cjs_code *code) {
+        rt->push(rt->load_fast(code->op1));
+    }
+
+    void cjsjit::load_fast_fast(cjsruntime *rt, cjs_code *code) {
+        rt->push(rt->load_fast(code->op1));
+        rt->push(rt->load_fast(code->op2));
+    }
+
+    void cjsjit::store_fast(cjsruntime *rt, cjs_code *code) {
+        auto obj = rt->top();
+        rt->current_stack->store_fast(rt->current_stack->info->names.at(code->op1), obj);
+    }
+
+    void cjsjit::store_fast_pop(cjsruntime *rt, cjs_code *code) {
+        auto obj = rt->pop();
+        rt->current_stack->store_fast(rt->current_stack->info->names.at(code->op1), obj);
+    }
+
+    void cjsjit::pop_top(cjsruntime *rt, cjs_code *) {
+        rt->pop();
+    }
+
+    void cjsjit::dup_top(cjsruntime *rt, cjs_code *) {
+        rt->push(rt->top());
+    }
+
+    int cjsjit::test(cjsruntime *rt, cjs_code *) {
+        auto t = rt->pop();
+        return t.lock()->to_bool() ? 1 : 0;
+    }
+
+    // 比较并跳转：0为假，1为真，负数为出错时的返回值
+    int cjsjit::compare(cjsruntime *rt, cjs_code *code) {
+        auto r = 0;
+        auto ret = rt->binop_top(code->op2, &r);
+        if (r != 0)
+            return -r;
+        return ret->to_bool() ? 1 : 0;
+    }
+
+    int cjsjit::binary(cjsruntime *rt, cjs_code *code) {
+        auto r = 0;
+        auto ret = rt->binop_top(code->code == BINARY_NUMBER ? code->op1 : code->code, &r);
+        if (r != 0)
+            return r;
+        rt->push(ret);
+        return 0;
+    }
+
+    // gc安全点，只在循环头调用；进入函数时可能正处于binop等嵌套调用中，不在此回收
+    void cjsjit::tick(cjsruntime *rt) {
+        if (++rt->jit_ticks >= JIT_TICK_PERIOD) {
+            rt->jit_ticks = 0;
+            rt->gc();
+        }
+    }
+
+#if JIT_X64
+    // rbx: 运行时，r12: &pc，r13: 指令地址表
+    class jit_buffer {
+    public:
+        explicit jit_buffer(size_t n) : label(n, 0) {}
+
+        void emit(std::initializer_list<uint8_t> bs) {
+            buf.insert(buf.end(), bs);
+        }
+
+        void imm32(uint32_t v) {
+            for (auto i = 0; i < 4; i++)
+                buf.push_back((uint8_t) (v >> (i * 8)));
+        }
+
+        void imm64(uint64_t v) {
+            for (auto i = 0; i < 8; i++)
+                buf.push_back((uint8_t) (v >> (i * 8)));
+        }
+
+        void bind(int l) {
+            label[l] = buf.size();
+        }
+
+        void rel32(int l) {
+            fixups.emplace_back(buf.size(), l);
+            imm32(0);
+        }
+
+        void patch() {
+            for (const auto &f : fixups) {
+                auto rel = (int32_t) ((int64_t) label[f.second] - (int64_t) (f.first + 4));
+                memcpy(&buf[f.first], &rel, sizeof(rel));
+            }
+        }
+
+        void store_pc(int pc) { // mov dword [r12], pc
+            emit({0x41, 0xC7, 0x04, 0x24});
+            imm32((uint32_t) pc);
+        }
+
+        void cmp_pc(int pc) { // cmp dword [r12], pc
+            emit({0x41, 0x81, 0x3C, 0x24});
+            imm32((uint32_t) pc);
+        }
+
+        template<class T>
+        void call(T fn, cjs_code *code) {
+            emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+            if (code) {
+                emit({0x48, 0xBE}); // mov rsi, imm64
+                imm64((uint64_t) (uintptr_t) code);
+            }
+            emit({0x48, 0xB8}); // mov rax, imm64
+            imm64((uint64_t) (uintptr_t) fn);
+            emit({0xFF, 0xD0}); // call rax
+        }
+
+        void test_eax() {
+            emit({0x85, 0xC0});
+        }
+
+        void mov_eax(int v) {
+            emit({0xB8});
+            imm32((uint32_t) v);
+        }
+
+        void jcc(uint8_t cc, int l) {
+            emit({0x0F, cc});
+            rel32(l);
+        }
+
+        void jmp(int l) {
+            emit({0xE9});
+            rel32(l);
+        }
+
+        std::vector<uint8_t> buf;
+        std::vector<size_t> label;
+        std::vector<std::pair<size_t, int>> fixups;
+    };
+
+    static const uint8_t JZ = 0x84, JNZ = 0x85, JS = 0x88;
+
+    static int jump_target(const cjs_code &c, int pc) {
+        switch (c.code) {
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+            case COMPARE_JUMP_IF_FALSE:
+            case COMPARE_NUMBER_JUMP_IF_FALSE:
+                return c.op1;
+            case JUMP_FORWARD:
+            case FOR_ITER:
+                return pc + c.op1;
+            default:
+                return -1;
+        }
+    }
+#endif
+
+    bool cjsjit::compile(cjs_function_info &info) {
+        if (info.jit_state != 0)
+            return info.jit_state > 0;
+        info.jit_state = -1;
+#if JIT_X64
+        auto n = (int) info.codes.size();
+        std::vector<bool> loop(n + 1, false);
+        for (auto i = 0; i < n; i++) {
+            auto t = jump_target(info.codes[i], i);
+            if (t < -1 || t > n)
+                return false;
+            if (t != -1 && t <= i)
+                loop[t] = true;
+        }
+        const auto L_END = n, L_ERROR = n + 1, L_EXIT = n + 2, L_DISPATCH = n + 3;
+        jit_buffer b(n + 4);
+        // 保存寄存器后按pc查表跳转，从任意指令处进入
+        b.emit({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13
+        b.emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+        b.emit({0x49, 0x89, 0xF4}); // mov r12, rsi
+        b.emit({0x49, 0x89, 0xD5}); // mov r13, rdx
+        b.bind(L_DISPATCH);
+        b.emit({0x49, 0x63, 0x04, 0x24}); // movsxd rax, dword [r12]
+        b.emit({0x41, 0xFF, 0x64, 0xC5, 0x00}); // jmp [r13 + rax * 8]
+        for (auto i = 0; i < n; i++) {
+            auto &c = info.codes[i];
+            b.bind(i);
+            b.store_pc(i);
+            if (loop[i])
+                b.call(&cjsjit::tick, nullptr);
+            switch (c.code) {
+                case NOP:
+                    break;
+                case LOAD_CONST:
+                    b.call(&cjsjit::load_const, &c);
+                    break;
+                case LOAD_FAST:
+                    b.call(&cjsjit::load_fast, &c);
+                    break;
+                case LOAD_FAST_FAST:
+                    b.call(&cjsjit::load_fast_fast, &c);
+                    break;
+                case STORE_FAST:
+                    b.call(&cjsjit::store_fast, &c);
+                    break;
+                case STORE_FAST_POP:
+                    b.call(&cjsjit::store_fast_pop, &c);
+                    break;
+                case DUP_TOP:
+                    b.call(&cjsjit::dup_top, &c);
+                    break;
+                case POP_TOP:
+                    if (i + 1 == n) { // 脚本末尾的表达式作为返回值
+                        b.mov_eax(2);
+                        b.jmp(L_EXIT);
+                    } else {
+                        b.call(&cjsjit::pop_top, &c);
+                    }
+                    break;
+                case RETURN_VALUE:
+                    b.mov_eax(2);
+                    b.jmp(L_EXIT);
+                    break;
+                case JUMP_ABSOLUTE:
+                case JUMP_FORWARD:
+                    b.jmp(jump_target(c, i));
+                    break;
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE:
+                    b.call(&cjsjit::test, &c);
+                    b.test_eax();
+                    b.jcc(c.code == POP_JUMP_IF_FALSE ? JZ : JNZ, c.op1);
+                    break;
+                case COMPARE_JUMP_IF_FALSE:
+                case COMPARE_NUMBER_JUMP_IF_FALSE:
+                    b.call(&cjsjit::compare, &c);
+                    b.test_eax();
+                    b.jcc(JS, L_ERROR);
+                    b.jcc(JZ, c.op1);
+                    break;
+                case COMPARE_LESS:
+                case COMPARE_LESS_EQUAL:
+                case COMPARE_EQUAL:
+                case COMPARE_NOT_EQUAL:
+                case COMPARE_GREATER:
+                case COMPARE_GREATER_EQUAL:
+                case COMPARE_FEQUAL:
+                case COMPARE_FNOT_EQUAL:
+                case BINARY_POWER:
+                case BINARY_MULTIPLY:
+                case BINARY_MODULO:
+                case BINARY_ADD:
+                case BINARY_SUBTRACT:
+                case BINARY_TRUE_DIVIDE:
+                case BINARY_LSHIFT:
+                case BINARY_RSHIFT:
+                case BINARY_URSHIFT:
+                case BINARY_AND:
+                case BINARY_XOR:
+                case BINARY_OR:
+                case BINARY_NUMBER:
+                    b.call(&cjsjit::binary, &c);
+                    b.test_eax();
+                    b.jcc(JNZ, L_EXIT);
+                    break;
+                default:
+                    // 其余指令交给解释器，pc不是下一条时重新查表
+                    b.call(&cjsjit::run, &c);
+                    b.test_eax();
+                    b.jcc(JNZ, L_EXIT);
+                    b.cmp_pc(i + 1);
+                    b.jcc(JNZ, L_DISPATCH);
+                    break;
+            }
+        }
+        b.bind(L_END);
+        b.store_pc(n);
+        b.mov_eax(4);
+        b.jmp(L_EXIT);
+        b.bind(L_ERROR);
+        b.emit({0xF7, 0xD8}); // neg eax
+        b.bind(L_EXIT);
+        b.emit({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r13; pop r12; pop rbx; ret
+        b.patch();
+        auto page = (size_t) sysconf(_SC_PAGESIZE);
+        auto size = (b.buf.size() + page - 1) / page * page;
+        auto mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return false;
+        memcpy(mem, b.buf.data(), b.buf.size());
+        if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(mem, size);
+            return false;
+        }
+        auto jit = std::make_shared<cjs_jit_code>();
+        jit->mem = mem;
+        jit->size = size;
+        jit->entry = (cjs_jit_code::entry_t) mem;
+        jit->table.resize(n + 1);
+        for (auto i = 0; i <= n; i++)
+            jit->table[i] = (uint8_t *) mem + b.label[i];
+        info.jit = jit;
+        info.jit_state = 1;
+        return true;
+#else
+        return false;
+#endif
+    }
+}
@@ -572,6 +572,7 @@ namespace clib {
     jsv_object::ref jsv_object::clear() {
         obj.clear();
         special.clear();
+        frames = nullptr;
         return std::dynamic_pointer_cast<jsv_object>(shared_from_this());
     }
 
@@ -623,7 +624,7 @@ namespace clib {
     std::string jsv_function::to_string(js_value_new *n, int hint) const {
         if (builtin || attr & at_readonly)
             return name;
-        return code ? code->text : "builtin";
+        return code ? code->get_text() : "builtin";
     }
 
     double jsv_function::to_number(js_value_new *n) const {
@@ -680,6 +681,8 @@ namespace clib {
         closure.reset();
         rests.clear();
         _try.clear();
+        reg = false;
+        slots.clear();
     }
 
     void cjs_function::reset(const sym_code_t::ref &code, js_value_new &n) {
@@ -692,17 +695,30 @@ namespace clib {
         info = std::move(code);
     }
 
-    cjs_function_info::cjs_function_info(const sym_code_t::ref &code, js_value_new &n) {
+    cjs_function_info::cjs_function_info(const sym_code_t::ref &code, js_value_new &n, bool lazy) {
         arrow = code->arrow;
         debugName = std::move(code->debugName);
+        debugFile = std::move(code->debugFile);
+        debugLabel = std::move(code->debugLabel);
         simpleName = std::move(code->simpleName);
         fullName = std::move(code->fullName);
         args = std::move(code->args_str);
         std::copy(code->closure_str.begin(), code->closure_str.end(), std::back_inserter(closure));
-        codes = std::move(code->codes);
-        text = std::move(code->text);
+        source = code->source;
+        start = code->start;
+        end = code->end;
         rest = code->rest;
         args_num = (int) args.size() - (rest ? 1 : 0);
+        pending = code;
+        if (!lazy)
+            load(n);
+    }
+
+    void cjs_function_info::load(js_value_new &n) {
+        if (!pending)
+            return;
+        auto code = std::move(pending);
+        codes = std::move(code->codes);
         const auto &c = code->consts;
         std::copy(c.get_names_data().begin(),
                   c.get_names_data().end(),
@@ -716,10 +732,16 @@ namespace clib {
         consts.resize(c.get_consts_data().size());
         for (size_t i = 0; i < c.get_consts_data().size(); i++) {
             consts[i] = load_const(c, i, n);
-            consts[i]->attr |= js_value::at_const;
+            n.set_const(consts[i]);
         }
     }
 
+    std::string cjs_function_info::get_text() const {
+        if (!source)
+            return "";
+        return source->substr((size_t) start, (size_t) (end - start));
+    }
+
     js_value::ref cjs_function_info::load_const(const cjs_consts &c, int op, js_value_new &n) {
         auto t = c.get_type(op);
         switch (t) {
@@ -733,8 +755,8 @@ namespace clib {
                 break;
             case r_function: {
                 auto f = n.new_function();
-                auto code = ((sym_code_t::weak_ref *) c.get_data(op))->lock();
-                f->code = std::make_shared<cjs_function_info>(code, n);
+                auto code = *(sym_code_t::ref *) c.get_data(op);
+                f->code = std::make_shared<cjs_function_info>(code, n, true);
                 return f;
             }
             default:
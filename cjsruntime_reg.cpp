@@ -0,0 +1,598 @@
+//
+// Project: clibjs
+// Created by bajdcc
+//
+
+#include <cassert>
+#include "cjsruntime.h"
+
+namespace clib {
+
+    // 栈式指令对操作数栈的影响，返回false表示寄存器字节码不支持该指令
+    static bool stack_effect(const cjs_code &c, int &pops, int &pushes) {
+        pops = pushes = 0;
+        switch (c.code) {
+            case NOP:
+            case DELETE_NAME:
+            case JUMP_FORWARD:
+            case JUMP_ABSOLUTE:
+                return true;
+            case LOAD_EMPTY:
+            case LOAD_NULL:
+            case LOAD_UNDEFINED:
+            case LOAD_TRUE:
+            case LOAD_FALSE:
+            case LOAD_ZERO:
+            case LOAD_THIS:
+            case LOAD_CONST:
+            case LOAD_NAME:
+            case LOAD_GLOBAL:
+            case LOAD_FAST:
+            case LOAD_DEREF:
+            case LOAD_FAST_ATTR:
+                pushes = 1;
+                return true;
+            case LOAD_FAST_FAST:
+            case LOAD_CLOSURE:
+                pushes = 2;
+                return true;
+            case POP_TOP:
+            case STORE_FAST_POP:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+            case JUMP_IF_FALSE_OR_POP:
+            case JUMP_IF_TRUE_OR_POP:
+            case THROW:
+                pops = 1;
+                return true;
+            case DUP_TOP:
+                pops = 1;
+                pushes = 2;
+                return true;
+            case UNARY_POSITIVE:
+            case UNARY_NEGATIVE:
+            case UNARY_NOT:
+            case UNARY_INVERT:
+            case UNARY_NEW:
+            case UNARY_TYPEOF:
+            case BINARY_INC:
+            case BINARY_DEC:
+            case LOAD_ATTR:
+            case LOAD_ATTR_OWN:
+            case STORE_NAME:
+            case STORE_GLOBAL:
+            case STORE_FAST:
+            case STORE_DEREF:
+                pops = 1;
+                pushes = 1;
+                return true;
+            case INSTANCE_OF:
+            case COMPARE_LESS:
+            case COMPARE_LESS_EQUAL:
+            case COMPARE_EQUAL:
+            case COMPARE_NOT_EQUAL:
+            case COMPARE_GREATER:
+            case COMPARE_GREATER_EQUAL:
+            case COMPARE_FEQUAL:
+            case COMPARE_FNOT_EQUAL:
+            case BINARY_POWER:
+            case BINARY_MULTIPLY:
+            case BINARY_MODULO:
+            case BINARY_ADD:
+            case BINARY_SUBTRACT:
+            case BINARY_FLOOR_DIVIDE:
+            case BINARY_TRUE_DIVIDE:
+            case BINARY_LSHIFT:
+            case BINARY_RSHIFT:
+            case BINARY_URSHIFT:
+            case BINARY_AND:
+            case BINARY_XOR:
+            case BINARY_OR:
+            case BINARY_NUMBER:
+            case BINARY_SUBSCR:
+            case BINARY_SUBSCR_INDEX:
+            case STORE_ATTR:
+                pops = 2;
+                pushes = 1;
+                return true;
+            case STORE_SUBSCR:
+                pops = 3;
+                pushes = 1;
+                return true;
+            case COMPARE_JUMP_IF_FALSE:
+            case COMPARE_NUMBER_JUMP_IF_FALSE:
+                pops = 2;
+                return true;
+            case INC_FAST:
+            case DEC_FAST:
+                pushes = c.op2 == 2 ? 0 : 1;
+                return true;
+            case UNARY_DELETE:
+                if (c.op1 >= 0 || c.op1 == -8)
+                    pops = 1;
+                else if (c.op1 == -1)
+                    pops = 2;
+                else if (c.op1 != -2)
+                    return false;
+                pushes = 1;
+                return true;
+            case BUILD_LIST:
+                if (c.op1 < 0)
+                    return false;
+                pops = c.op1;
+                pushes = 1;
+                return true;
+            case BUILD_MAP:
+                if (c.op1 < 0)
+                    return false;
+                pops = c.op1 * 2;
+                pushes = 1;
+                return true;
+            case MAKE_FUNCTION:
+                pops = ((uint32_t) c.op1 & 8U) ? 3 : 2;
+                pushes = 1;
+                return true;
+            case CALL_FUNCTION:
+            case CALL_FUNCTION_EX:
+                if (c.op1 < 0)
+                    return false;
+                pops = c.op1 + 1;
+                pushes = 1;
+                return true;
+            case LOAD_METHOD:
+                pops = c.op1 >= 0 ? 1 : 2;
+                pushes = 2;
+                return true;
+            case CALL_METHOD:
+            case CALL_METHOD_BUILTIN:
+                if (c.op1 < 0)
+                    return false;
+                pops = c.op1 + 2;
+                pushes = 1;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // 由栈式字节码生成寄存器字节码：栈深度d处的值放在临时槽d，
+    // 局部变量和常量的读取推迟到真正使用的指令上
+    bool cjs_function_info::load_reg() {
+        if (reg_state != 0)
+            return reg_state > 0;
+        reg_state = -1;
+        auto n = (int) codes.size();
+        std::vector<int> target(n, -1);
+        for (auto i = 0; i < n; i++) {
+            const auto &c = codes[i];
+            switch (c.code) {
+                case JUMP_ABSOLUTE:
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE:
+                case JUMP_IF_FALSE_OR_POP:
+                case JUMP_IF_TRUE_OR_POP:
+                case COMPARE_JUMP_IF_FALSE:
+                case COMPARE_NUMBER_JUMP_IF_FALSE:
+                    target[i] = c.op1;
+                    break;
+                case JUMP_FORWARD:
+                    target[i] = i + c.op1;
+                    break;
+                case RETURN_VALUE:
+                    break;
+                default: {
+                    int pops, pushes;
+                    if (!stack_effect(c, pops, pushes))
+                        return false;
+                }
+                    break;
+            }
+            if (target[i] < -1 || target[i] > n)
+                return false;
+        }
+        // 各指令处的栈深度
+        std::vector<int> depth(n + 1, -1);
+        std::vector<int> work;
+        auto max_depth = 0;
+        auto propagate = [&](int j, int d) {
+            if (depth[j] == -1) {
+                depth[j] = d;
+                work.push_back(j);
+                return true;
+            }
+            return depth[j] == d;
+        };
+        depth[0] = 0;
+        work.push_back(0);
+        while (!work.empty()) {
+            auto i = work.back();
+            work.pop_back();
+            if (i == n)
+                continue;
+            const auto &c = codes[i];
+            auto d = depth[i];
+            if (c.code == RETURN_VALUE)
+                continue;
+            int pops, pushes;
+            stack_effect(c, pops, pushes);
+            if (pops > d)
+                return false;
+            auto nd = d - pops + pushes;
+            max_depth = std::max(max_depth, nd);
+            if (target[i] != -1) {
+                auto jd = c.code == JUMP_IF_FALSE_OR_POP || c.code == JUMP_IF_TRUE_OR_POP ? d : nd;
+                if (!propagate(target[i], jd))
+                    return false;
+            }
+            if (c.code == JUMP_ABSOLUTE || c.code == JUMP_FORWARD || c.code == THROW)
+                continue;
+            if (!propagate(i + 1, nd))
+                return false;
+        }
+        std::vector<bool> label(n + 1, false);
+        for (auto i = 0; i < n; i++) {
+            if (target[i] != -1)
+                label[target[i]] = true;
+        }
+        std::vector<int> rpc(n + 1, -1);
+        std::vector<int> vs;
+        auto i = 0;
+        auto emit = [&](int code, int op, int dst, int a, int b, int src) {
+            rcodes.push_back({code, op, dst, a, b, src});
+        };
+        auto flush = [&]() {
+            for (auto k = 0; k < (int) vs.size(); k++) {
+                if (vs[k] != k) {
+                    emit(R_MOV, 0, k, vs[k], 0, i);
+                    vs[k] = k;
+                }
+            }
+        };
+        // 变量即将被改写或可能执行任意代码前，把推迟读取的局部变量落到临时槽
+        auto spill = [&](int x) {
+            for (auto k = 0; k < (int) vs.size(); k++) {
+                if (vs[k] < 0 && (x == REG_NONE || vs[k] == x)) {
+                    emit(R_MOV, 0, k, vs[k], 0, i);
+                    vs[k] = k;
+                }
+            }
+        };
+        auto pop = [&]() {
+            auto v = vs.back();
+            vs.pop_back();
+            return v;
+        };
+        auto dead = true;
+        for (i = 0; i < n; i++) {
+            if (depth[i] == -1) {
+                dead = true;
+                continue;
+            }
+            if (dead) {
+                vs.resize(depth[i]);
+                for (auto k = 0; k < depth[i]; k++)
+                    vs[k] = k;
+            } else if (label[i]) {
+                flush();
+            }
+            dead = false;
+            rpc[i] = (int) rcodes.size();
+            const auto &c = codes[i];
+            auto d = (int) vs.size();
+            switch (c.code) {
+                case NOP:
+                case DELETE_NAME:
+                    break;
+                case LOAD_FAST:
+                    vs.push_back(-c.op1 - 1);
+                    break;
+                case LOAD_FAST_FAST:
+                    vs.push_back(-c.op1 - 1);
+                    vs.push_back(-c.op2 - 1);
+                    break;
+                case LOAD_CONST:
+                    vs.push_back(REG_CONST + c.op1);
+                    break;
+                case LOAD_EMPTY:
+                case LOAD_NULL:
+                case LOAD_UNDEFINED:
+                case LOAD_TRUE:
+                case LOAD_FALSE:
+                case LOAD_ZERO:
+                    emit(R_LOADX, c.code, d, c.op1, 0, i);
+                    vs.push_back(d);
+                    break;
+                case LOAD_FAST_ATTR:
+                    emit(R_GETATTR, c.op2, d, -c.op1 - 1, 0, i);
+                    vs.push_back(d);
+                    break;
+                case LOAD_ATTR:
+                case LOAD_ATTR_OWN:
+                    emit(R_GETATTR, c.op1, d - 1, pop(), 0, i);
+                    vs.push_back(d - 1);
+                    break;
+                case POP_TOP:
+                    if (i + 1 == n) {
+                        emit(R_RET, 0, 0, vs.back(), 0, i);
+                        dead = true;
+                    }
+                    vs.pop_back();
+                    break;
+                case DUP_TOP:
+                    vs.push_back(vs.back());
+                    break;
+                case STORE_FAST:
+                case STORE_FAST_POP:
+                    spill(-c.op1 - 1);
+                    emit(R_MOV, 0, -c.op1 - 1, vs.back(), 0, i);
+                    if (c.code == STORE_FAST_POP)
+                        vs.pop_back();
+                    break;
+                case INC_FAST:
+                case DEC_FAST: {
+                    auto op = c.code == INC_FAST ? BINARY_ADD : BINARY_SUBTRACT;
+                    auto x = -c.op1 - 1;
+                    spill(REG_NONE);
+                    if (c.op2 == 0) {
+                        emit(R_MOV, 0, d, x, 0, i);
+                        emit(R_INC, op, x, d, 0, i);
+                        vs.push_back(d);
+                    } else {
+                        emit(R_INC, op, x, x, 0, i);
+                        if (c.op2 == 1)
+                            vs.push_back(x);
+                    }
+                }
+                    break;
+                case BINARY_INC:
+                case BINARY_DEC: {
+                    auto a = pop();
+                    spill(REG_NONE);
+                    emit(R_INC, c.code == BINARY_INC ? BINARY_ADD : BINARY_SUBTRACT, d - 1, a, 0, i);
+                    vs.push_back(d - 1);
+                }
+                    break;
+                case COMPARE_LESS:
+                case COMPARE_LESS_EQUAL:
+                case COMPARE_EQUAL:
+                case COMPARE_NOT_EQUAL:
+                case COMPARE_GREATER:
+                case COMPARE_GREATER_EQUAL:
+                case COMPARE_FEQUAL:
+                case COMPARE_FNOT_EQUAL:
+                case BINARY_POWER:
+                case BINARY_MULTIPLY:
+                case BINARY_MODULO:
+                case BINARY_ADD:
+                case BINARY_SUBTRACT:
+                case BINARY_FLOOR_DIVIDE:
+                case BINARY_TRUE_DIVIDE:
+                case BINARY_LSHIFT:
+                case BINARY_RSHIFT:
+                case BINARY_URSHIFT:
+                case BINARY_AND:
+                case BINARY_XOR:
+                case BINARY_OR:
+                case BINARY_NUMBER: {
+                    auto b = pop();
+                    auto a = pop();
+                    spill(REG_NONE);
+                    emit(R_BINOP, c.code == BINARY_NUMBER ? c.op1 : c.code, d - 2, a, b, i);
+                    vs.push_back(d - 2);
+                }
+                    break;
+                case UNARY_POSITIVE:
+                case UNARY_NEGATIVE:
+                case UNARY_NOT:
+                case UNARY_INVERT:
+                case UNARY_TYPEOF: {
+                    auto a = pop();
+                    spill(REG_NONE);
+                    emit(R_UNOP, c.code, d - 1, a, 0, i);
+                    vs.push_back(d - 1);
+                }
+                    break;
+                case JUMP_ABSOLUTE:
+                case JUMP_FORWARD:
+                    flush();
+                    emit(R_JMP, 0, target[i], 0, 0, i);
+                    dead = true;
+                    break;
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE: {
+                    auto a = pop();
+                    flush();
+                    emit(c.code == POP_JUMP_IF_FALSE ? R_JF : R_JT, 0, target[i], a, 0, i);
+                }
+                    break;
+                case JUMP_IF_FALSE_OR_POP:
+                case JUMP_IF_TRUE_OR_POP:
+                    flush();
+                    emit(c.code == JUMP_IF_FALSE_OR_POP ? R_JF : R_JT, 0, target[i], d - 1, 0, i);
+                    vs.pop_back();
+                    break;
+                case COMPARE_JUMP_IF_FALSE:
+                case COMPARE_NUMBER_JUMP_IF_FALSE: {
+                    auto b = pop();
+                    auto a = pop();
+                    spill(REG_NONE);
+                    flush();
+                    emit(R_CMPJF, c.op2, target[i], a, b, i);
+                }
+                    break;
+                case RETURN_VALUE:
+                    emit(R_RET, 0, 0, d > 0 ? vs.back() : REG_NONE, 0, i);
+                    dead = true;
+                    break;
+                default: {
+                    // 其余指令把操作数压到帧尾部，按栈式执行后取回结果
+                    int pops, pushes;
+                    stack_effect(c, pops, pushes);
+                    spill(REG_NONE);
+                    for (auto k = d - pops; k < d; k++)
+                        emit(R_PUSH, 0, 0, vs[k], 0, i);
+                    vs.resize(d - pops);
+                    emit(R_STACK, 0, 0, i, 0, i);
+                    for (auto k = pushes - 1; k >= 0; k--)
+                        emit(R_POP, 0, d - pops + k, 0, 0, i + 1);
+                    for (auto k = 0; k < pushes; k++)
+                        vs.push_back(d - pops + k);
+                    if (c.code == THROW)
+                        dead = true;
+                }
+                    break;
+            }
+        }
+        rpc[n] = (int) rcodes.size();
+        for (auto &rc : rcodes) {
+            switch (rc.code) {
+                case R_JMP:
+                case R_JF:
+                case R_JT:
+                case R_CMPJF:
+                    rc.dst = rpc[rc.dst];
+                    assert(rc.dst != -1);
+                    break;
+                default:
+                    break;
+            }
+        }
+        reg_size = max_depth;
+        reg_state = 1;
+        return true;
+    }
+
+    js_value::weak_ref *cjsruntime::reg_slot(int op) {
+        auto &s = current_stack->slots[op];
+        if (!s) {
+            auto &obj = current_stack->envs.lock()->obj;
+            auto f = obj.find(current_stack->info->names[op]);
+            if (f != obj.end())
+                s = &f->second;
+        }
+        return s;
+    }
+
+    js_value::ref cjsruntime::reg_get(int op) {
+        if (op < 0) {
+            auto s = reg_slot(-op - 1);
+            return s ? s->lock() : permanents._undefined;
+        }
+        if (op >= REG_CONST)
+            return current_stack->info->consts[op - REG_CONST];
+        return current_stack->stack[op].lock();
+    }
+
+    void cjsruntime::reg_set(int op, const js_value::ref &value) {
+        if (op >= 0) {
+            current_stack->stack[op] = value;
+            return;
+        }
+        auto s = reg_slot(-op - 1);
+        if (!s) {
+            s = &current_stack->envs.lock()->obj[current_stack->info->names[-op - 1]];
+            current_stack->slots[-op - 1] = s;
+        }
+        *s = value;
+    }
+
+    int cjsruntime::run_reg(const cjs_reg_code &code) {
+        switch (code.code) {
+            case R_MOV:
+                reg_set(code.dst, reg_get(code.a));
+                break;
+            case R_LOADX:
+                switch (code.op) {
+                    case LOAD_EMPTY:
+                        current_stack->stack[code.dst].reset();
+                        break;
+                    case LOAD_NULL:
+                        reg_set(code.dst, new_null());
+                        break;
+                    case LOAD_UNDEFINED:
+                        reg_set(code.dst, new_undefined());
+                        break;
+                    case LOAD_TRUE:
+                        reg_set(code.dst, new_boolean(true));
+                        break;
+                    case LOAD_FALSE:
+                        reg_set(code.dst, new_boolean(false));
+                        break;
+                    case LOAD_ZERO:
+                        reg_set(code.dst, code.a == 0 ? permanents._zero : permanents._minus_zero);
+                        break;
+                    default:
+                        assert(!"invalid load");
+                        break;
+                }
+                break;
+            case R_GETATTR:
+                reg_set(code.dst, load_attr(reg_get(code.a), current_stack->info->names.at(code.op)));
+                break;
+            case R_BINOP:
+            case R_INC: {
+                auto r = 0;
+                auto ret = binop(code.op, reg_get(code.a),
+                                 code.code == R_INC ? permanents._one : reg_get(code.b), &r);
+                if (r != 0)
+                    return r;
+                assert(ret);
+                reg_set(code.dst, ret);
+            }
+                break;
+            case R_UNOP: {
+                auto ret = reg_get(code.a)->unary_op(*this, code.op);
+                assert(ret);
+                reg_set(code.dst, ret);
+            }
+                break;
+            case R_JMP:
+                current_stack->pc = code.dst;
+                return 0;
+            case R_JF:
+                if (!reg_get(code.a)->to_bool()) {
+                    current_stack->pc = code.dst;
+                    return 0;
+                }
+                break;
+            case R_JT:
+                if (reg_get(code.a)->to_bool()) {
+                    current_stack->pc = code.dst;
+                    return 0;
+                }
+                break;
+            case R_CMPJF: {
+                auto r = 0;
+                auto ret = binop(code.op, reg_get(code.a), reg_get(code.b), &r);
+                if (r != 0)
+                    return r;
+                if (!ret->to_bool()) {
+                    current_stack->pc = code.dst;
+                    return 0;
+                }
+            }
+                break;
+            case R_RET:
+                if (code.a == REG_NONE)
+                    push(new_undefined());
+                else
+                    push(reg_get(code.a));
+                return 2;
+            case R_PUSH:
+                push(reg_get(code.a));
+                break;
+            case R_POP: {
+                auto v = pop();
+                current_stack->stack[code.dst] = std::move(v);
+            }
+                break;
+            case R_STACK:
+                return run(current_stack->info->codes[code.a]);
+            default:
+                assert(!"invalid opcode");
+                return 1;
+        }
+        current_stack->pc++;
+        return 0;
+    }
+}
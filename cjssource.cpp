@@ -0,0 +1,116 @@
+//
+// Project: clibjs
+// Created by bajdcc
+//
+
+#include <fstream>
+#include <sstream>
+#include "cjssource.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace clib {
+
+    cjs_source::~cjs_source() {
+        if (!map)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(map);
+#else
+        munmap(map, map_len);
+#endif
+    }
+
+    cjs_source::ref cjs_source::from_string(std::string s) {
+        auto src = std::make_shared<cjs_source>();
+        src->str = std::move(s);
+        src->ptr = src->str.data();
+        src->len = src->str.length();
+        return src;
+    }
+
+    cjs_source::ref cjs_source::from_buffer(const char *data, size_t len) {
+        auto src = std::make_shared<cjs_source>();
+        src->ptr = data;
+        src->len = len;
+        return src;
+    }
+
+    static cjs_source::ref read_file(const std::string &filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+            return nullptr;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        return cjs_source::from_string(buffer.str());
+    }
+
+    cjs_source::ref cjs_source::from_file(const std::string &filename) {
+#ifdef _WIN32
+        auto file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            return read_file(filename);
+        }
+        auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+            return read_file(filename);
+        auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view)
+            return read_file(filename);
+        auto src = std::make_shared<cjs_source>();
+        src->map = view;
+        src->map_len = (size_t) size.QuadPart;
+#else
+        auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            return nullptr;
+        struct stat st{};
+        if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            close(fd);
+            return read_file(filename);
+        }
+        auto view = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED)
+            return read_file(filename);
+        auto src = std::make_shared<cjs_source>();
+        src->map = view;
+        src->map_len = (size_t) st.st_size;
+#endif
+        src->ptr = (const char *) src->map;
+        src->len = src->map_len;
+        return src;
+    }
+
+    const char *cjs_source::data() const {
+        return ptr;
+    }
+
+    size_t cjs_source::length() const {
+        return len;
+    }
+
+    bool cjs_source::empty() const {
+        return len == 0;
+    }
+
+    std::string cjs_source::substr(size_t pos, size_t n) const {
+        if (pos >= len)
+            return "";
+        return std::string(ptr + pos, n < len - pos ? n : len - pos);
+    }
+}
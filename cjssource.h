@@ -0,0 +1,42 @@
+//
+// Project: clibjs
+// Created by bajdcc
+//
+
+#ifndef CLIBJS_CJSSOURCE_H
+#define CLIBJS_CJSSOURCE_H
+
+#include <string>
+#include <memory>
+
+namespace clib {
+
+    // 源代码区间，可持有字符串、引用外部缓冲区或映射文件
+    class cjs_source {
+    public:
+        using ref = std::shared_ptr<cjs_source>;
+        cjs_source() = default;
+        ~cjs_source();
+
+        cjs_source(const cjs_source &) = delete;
+        cjs_source &operator=(const cjs_source &) = delete;
+
+        static ref from_string(std::string s);
+        static ref from_buffer(const char *data, size_t len); // 调用者保证缓冲区生命周期
+        static ref from_file(const std::string &filename);
+
+        const char *data() const;
+        size_t length() const;
+        bool empty() const;
+        std::string substr(size_t pos, size_t n) const;
+
+    private:
+        const char *ptr{nullptr};
+        size_t len{0};
+        std::string str;
+        void *map{nullptr};
+        size_t map_len{0};
+    };
+}
+
+#endif //CLIBJS_CJSSOURCE_H
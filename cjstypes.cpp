@@ -331,6 +331,7 @@ namespace clib {
                     "POP_FINALLY",
                     "THROW",
                     "EXIT_FINALLY",
+                    "END_FINALLY",
                     "LOAD_FAST",
                     "STORE_FAST",
                     "CALL_FUNCTION",
@@ -342,6 +343,17 @@ namespace clib {
                     "CALL_FUNCTION_EX",
                     "LOAD_METHOD",
                     "CALL_METHOD",
+                    "LOAD_FAST_FAST",
+                    "LOAD_FAST_ATTR",
+                    "STORE_FAST_POP",
+                    "INC_FAST",
+                    "DEC_FAST",
+                    "COMPARE_JUMP_IF_FALSE",
+                    "BINARY_NUMBER",
+                    "COMPARE_NUMBER_JUMP_IF_FALSE",
+                    "BINARY_SUBSCR_INDEX",
+                    "LOAD_ATTR_OWN",
+                    "CALL_METHOD_BUILTIN",
             };
             return p.at(t);
         }
@@ -0,0 +1,55 @@
+//
+// Project: clibjs
+// 宿主接口示例：预编译脚本，反复调用其中的函数
+//
+
+#include <iostream>
+#include "../cjs.h"
+
+static const char *script = R"(
+var count = 0;
+function add(a, b) {
+    count++;
+    return a + b;
+}
+function later(s) {
+    setTimeout(function () {
+        console.log("timer", s, count);
+    }, 0);
+    return s;
+}
+function fail(s) {
+    throw new TypeError(s);
+}
+)";
+
+int main() {
+    clib::cjs js;
+    std::string error;
+    if (js.compile("<bad>", "var a = (1;", error) == nullptr)
+        std::cout << "compile error: " << error << std::endl;
+    auto s = js.compile("<host>", script, error);
+    if (!s) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    js.run(s);
+    auto add = js.get_function("add");
+    clib::js_value::ref ret;
+    double sum = 0;
+    for (auto i = 0; i < 1000; i++) {
+        if (js.call(s, add, {js.value((double) i), js.value(1.0)}, ret) != 0)
+            return 1;
+        sum += js.to_number(ret);
+    }
+    std::cout << "sum: " << sum << std::endl;
+    // 默认auto_loop开启，call返回前定时器已执行
+    js.call(s, js.get_function("later"), {js.value(std::string("auto"))}, ret);
+    js.set_auto_loop(false);
+    js.call(s, js.get_function("later"), {js.value(std::string("manual"))}, ret);
+    std::cout << "returned: " << js.to_string(ret) << std::endl;
+    js.run_until_idle();
+    if (js.call(s, js.get_function("fail"), {js.value(std::string("oops"))}, ret) == 9)
+        std::cout << "thrown: " << js.to_string(ret) << std::endl;
+    return 0;
+}
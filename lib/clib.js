@@ -2,4 +2,5 @@ window = this;
 sys.exec_file("clib_error.js");
 sys.exec_file("clib_function.js");
 sys.exec_file("clib_array.js");
+sys.exec_file("clib_promise.js");
 return "library loaded";
\ No newline at end of file
@@ -0,0 +1,158 @@
+Promise = (function () {
+    var PENDING = 0, FULFILLED = 1, REJECTED = 2;
+    var $ = {};
+    $.settle = function (p, state, value) {
+        if (p._state !== PENDING)
+            return;
+        p._state = state;
+        p._value = value;
+        var reactions = p._reactions;
+        p._reactions = undefined;
+        for (var i = 0; i < reactions.length; i++)
+            $.schedule(p, reactions[i]);
+    };
+    $.schedule = function (p, r) {
+        queueMicrotask(function () {
+            var handler = p._state === FULFILLED ? r.onFulfilled : r.onRejected;
+            if (typeof handler !== "function") {
+                if (p._state === FULFILLED)
+                    $.resolve(r.promise, p._value);
+                else
+                    $.settle(r.promise, REJECTED, p._value);
+                return;
+            }
+            var x;
+            try {
+                x = handler(p._value);
+            } catch (e) {
+                $.settle(r.promise, REJECTED, e);
+                return;
+            }
+            $.resolve(r.promise, x);
+        });
+    };
+    $.resolve = function (p, x) {
+        if (x === p)
+            return $.settle(p, REJECTED, new Error("Chaining cycle detected for promise"));
+        if (x !== null && (typeof x === "object" || typeof x === "function")) {
+            var then;
+            try {
+                then = x.then;
+            } catch (e) {
+                return $.settle(p, REJECTED, e);
+            }
+            if (typeof then === "function") {
+                queueMicrotask(function () {
+                    var called = false;
+                    try {
+                        then.call(x, function (y) {
+                            if (called) return;
+                            called = true;
+                            $.resolve(p, y);
+                        }, function (r) {
+                            if (called) return;
+                            called = true;
+                            $.settle(p, REJECTED, r);
+                        });
+                    } catch (e) {
+                        if (!called) {
+                            called = true;
+                            $.settle(p, REJECTED, e);
+                        }
+                    }
+                });
+                return;
+            }
+        }
+        $.settle(p, FULFILLED, x);
+    };
+    var Promise = function (executor) {
+        var self = this;
+        var called = false;
+        self._state = PENDING;
+        self._value = undefined;
+        self._reactions = [];
+        try {
+            executor(function (value) {
+                if (called) return;
+                called = true;
+                $.resolve(self, value);
+            }, function (reason) {
+                if (called) return;
+                called = true;
+                $.settle(self, REJECTED, reason);
+            });
+        } catch (e) {
+            if (!called) {
+                called = true;
+                $.settle(self, REJECTED, e);
+            }
+        }
+    };
+    Promise.prototype.then = function (onFulfilled, onRejected) {
+        var noop = function () {
+        };
+        var p = new Promise(noop);
+        var r = {onFulfilled: onFulfilled, onRejected: onRejected, promise: p};
+        if (this._state === PENDING)
+            this._reactions.push(r);
+        else
+            $.schedule(this, r);
+        return p;
+    };
+    Promise.prototype["catch"] = function (onRejected) {
+        return this.then(undefined, onRejected);
+    };
+    Promise.prototype["finally"] = function (f) {
+        return this.then(function (value) {
+            return Promise.resolve(f()).then(function () {
+                return value;
+            });
+        }, function (reason) {
+            return Promise.resolve(f()).then(function () {
+                throw reason;
+            });
+        });
+    };
+    Promise.resolve = function (value) {
+        if (value instanceof Promise)
+            return value;
+        var executor = function (res) {
+            res(value);
+        };
+        return new Promise(executor);
+    };
+    Promise.reject = function (reason) {
+        var executor = function (res, rej) {
+            rej(reason);
+        };
+        return new Promise(executor);
+    };
+    Promise.all = function (list) {
+        var executor = function (res, rej) {
+            var n = list.length, values = Array(n);
+            if (n === 0)
+                return res(values);
+            for (var i = 0; i < list.length; i++) {
+                (function (i) {
+                    Promise.resolve(list[i]).then(function (value) {
+                        values[i] = value;
+                        if (--n === 0)
+                            res(values);
+                    }, rej);
+                })(i);
+            }
+        };
+        return new Promise(executor);
+    };
+    Promise.race = function (list) {
+        var executor = function (res, rej) {
+            for (var i = 0; i < list.length; i++)
+                Promise.resolve(list[i]).then(res, rej);
+        };
+        return new Promise(executor);
+    };
+    return Promise;
+})();
+sys.builtin(Promise);
+return;
@@ -1,13 +1,28 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 #include "cjs.h"
 
-int main() {
+int main(int argc, char **argv) {
+    auto show_steps = false;
     const auto filename = ROOT_DIR R"(test/test.js)";
     char buf[256];
     snprintf(buf, sizeof(buf), "sys.exec_file(\"%s\");", filename);
     clib::cjs js;
+    for (auto i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reg") == 0)
+            js.set_register_vm(true);
+        else if (strcmp(argv[i], "--jit") == 0)
+            js.set_jit(true);
+        else if (strcmp(argv[i], "--jit-force") == 0)
+            js.set_jit(true, true);
+        else if (strcmp(argv[i], "--steps") == 0)
+            show_steps = true;
+        else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc)
+            js.set_max_depth(strtoul(argv[++i], nullptr, 10));
+    }
     js.exec("<starter>", buf);
     while (true) {
         std::string input;
@@ -16,5 +31,7 @@ int main() {
             break;
         js.exec("<stdin>", input);
     }
+    if (show_steps)
+        std::cerr << "steps: " << js.get_steps() << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,2 @@
+// 语法错误，供test_18.js检查SyntaxError
+var a = (1;
@@ -7,4 +7,14 @@ test(6);
 test(8);
 test(9);
 test(10);
+test(11);
+test(12);
+test(13);
+test(14);
+test(15);
+test(16);
+test(17);
+test(18);
+test(19);
+test(20);
 return;
\ No newline at end of file
@@ -0,0 +1,33 @@
+function f(n) {
+    return n == 0 ? 0 : 1 + f(n - 1);
+}
+console.log(f(1000));
+try {
+    f(1000000);
+} catch (e) {
+    console.log(e.name, e.message, e instanceof RangeError, e instanceof Error);
+}
+function F(n) {
+    if (n > 0)
+        new F(n - 1);
+}
+new F(100);
+try {
+    new F(100000);
+} catch (e) {
+    console.log(e.name, e.message);
+}
+var o = {
+    valueOf: function () {
+        return this + 1;
+    }
+};
+try {
+    o + 1;
+} catch (e) {
+    console.log(e.name, e.message);
+}
+console.log([1, 2, 3].map(function (x) {
+    return f(x);
+}));
+console.log(f(10));
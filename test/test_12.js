@@ -0,0 +1,7 @@
+var a;
+console.log(undefined);
+console.log(typeof undefined, a === undefined, undefined == null);
+console.log([undefined].length, {u: 1}.v === undefined);
+(function (x) {
+    console.log(x === undefined);
+})();
@@ -0,0 +1,5 @@
+var b = 2, c = "c";
+var o = {a: b, c: c, d: b + 1, "e": b};
+console.log(o.a, o.c, o.d, o.e);
+var p = {o: o, n: {x: b}};
+console.log(p.o.a, p.n.x);
@@ -0,0 +1,18 @@
+var o = {
+    n: 1,
+    get: function () {
+        return this.n;
+    },
+    add: function (x) {
+        this.n += x;
+        return this;
+    }
+};
+var k = "get";
+console.log(o[k](), o["get"]());
+o["add"](2)["add"](3);
+console.log(o.n);
+var fs = [function () {
+    return this.length;
+}];
+console.log(fs[0]());
@@ -0,0 +1,42 @@
+console.log((function () {
+    try {
+        return 1;
+    } catch (e) {
+        return 2;
+    }
+})());
+var log = [];
+try {
+    log.push("try");
+} catch (e) {
+    log.push("catch");
+}
+log.push("after");
+console.log(log);
+log = [];
+try {
+    try {
+        throw 1;
+    } catch (e) {
+        log.push("inner " + e);
+        throw e + 1;
+    }
+} catch (e) {
+    log.push("outer " + e);
+} finally {
+    log.push("finally");
+}
+console.log(log);
+log = [];
+for (var i = 0; i < 3; i++) {
+    try {
+        if (i == 1)
+            continue;
+        log.push(i);
+    } catch (e) {
+        log.push("catch");
+    } finally {
+        log.push("f" + i);
+    }
+}
+console.log(log);
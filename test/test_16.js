@@ -0,0 +1,10 @@
+var o = {u: undefined, n: null, t: true, f: NaN};
+o.u = 1;
+o.n = 2;
+o["t"] = 3;
+o["f"] = 4;
+console.log(o.u, o.n, o.t, o.f);
+var log = console.log;
+console.log = 1;
+console["log"] = 2;
+console.log(console.log === log);
@@ -0,0 +1,40 @@
+var log = [];
+setTimeout(function () {
+    log.push("timeout");
+    console.log(log);
+}, 0);
+queueMicrotask(function () {
+    log.push("micro");
+});
+Promise.resolve(1).then(function (x) {
+    log.push("then " + x);
+    return x + 1;
+}).then(function (x) {
+    log.push("then " + x);
+    return Promise.resolve(x * 10);
+}).then(function (x) {
+    log.push("then " + x);
+});
+Promise.reject(new Error("bad")).then(function () {
+    log.push("skipped");
+}).then(undefined, function (e) {
+    log.push("catch " + e.message);
+    throw "again";
+})["catch"](function (e) {
+    log.push("catch " + e);
+})["finally"](function () {
+    log.push("finally");
+});
+var executor = function () {
+    throw 2;
+};
+var p = new Promise(executor);
+p["catch"](function (e) {
+    log.push("executor " + e);
+});
+log.push("sync");
+try {
+    queueMicrotask(1);
+} catch (e) {
+    console.log(e.name, e instanceof TypeError);
+}
@@ -0,0 +1,36 @@
+try {
+    undefined_variable;
+} catch (e) {
+    console.log(e.name, e.message, e instanceof ReferenceError, e instanceof Error);
+}
+try {
+    undefined_function(1);
+} catch (e) {
+    console.log(e.name, e.message);
+}
+var e = new ReferenceError("x");
+console.log(e.name, e.message, e instanceof ReferenceError, e instanceof SyntaxError);
+e = new SyntaxError("y");
+console.log(e.name, e.message, e instanceof SyntaxError, e instanceof Error);
+e = new TypeError("z");
+console.log(e.name, e.message, e instanceof TypeError);
+console.log(new RangeError().message === undefined);
+try {
+    throw new SyntaxError("thrown");
+} catch (e) {
+    console.log(e.name, e.message, typeof e.stack);
+}
+try {
+    sys.exec_file("syntax_error.js");
+} catch (e) {
+    console.log(e.name, e.message, e instanceof SyntaxError);
+}
+var n = 0;
+for (var i = 0; i < 1000; i++) {
+    try {
+        missing;
+    } catch (e) {
+        n++;
+    }
+}
+console.log(n);
@@ -0,0 +1,21 @@
+function keys(o) {
+    var ks = [];
+    for (var k in o) {
+        ks.push(k);
+        for (var i = ks.length - 1; i > 0 && ks[i - 1] > k; i--) {
+            ks[i] = ks[i - 1];
+            ks[i - 1] = k;
+        }
+    }
+    return ks;
+}
+var e = new Error("m");
+console.log(keys(e), e.hasOwnProperty("stack"));
+try {
+    missing;
+} catch (e) {
+    console.log(keys(e), typeof e.stack);
+}
+e = new RangeError("r");
+var s = e.stack;
+console.log(keys(e), s === e.stack);
@@ -0,0 +1,22 @@
+var log = [];
+var far = setTimeout(function () {
+    log.push("far");
+}, 100000);
+clearTimeout(far);
+var b;
+setTimeout(function () {
+    log.push("a");
+    clearTimeout(b);
+}, 0);
+b = setTimeout(function () {
+    log.push("b");
+}, 0);
+var n = 0, iv;
+iv = setInterval(function () {
+    log.push("i" + n);
+    if (++n == 3)
+        clearInterval(iv);
+}, 1);
+setTimeout(function () {
+    console.log(log);
+}, 50);